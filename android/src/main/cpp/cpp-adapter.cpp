@@ -1,6 +1,19 @@
 #include <jni.h>
 #include "nitroonnxruntimeOnLoad.hpp"
+#include "MappedModel.hpp"
+#include "MemoryManager.hpp"
 
 JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM* vm, void*) {
   return margelo::nitro::nitroonnxruntime::initialize(vm);
 }
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_margelo_nitro_nitroonnxruntime_AssetManager_nativeSetAssetManager(JNIEnv* env, jobject, jobject assetManager) {
+  margelo::nitro::nitroonnxruntime::MappedModel::setAssetManager(env, assetManager);
+}
+
+extern "C" JNIEXPORT void JNICALL
+Java_com_margelo_nitro_nitroonnxruntime_AssetManager_nativeHandleMemoryPressure(JNIEnv*, jclass, jboolean critical) {
+  using margelo::nitro::nitroonnxruntime::MemoryManager;
+  MemoryManager::shared().handlePressure(critical ? MemoryManager::Pressure::Critical : MemoryManager::Pressure::Moderate);
+}
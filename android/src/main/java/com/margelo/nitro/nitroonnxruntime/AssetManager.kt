@@ -1,7 +1,9 @@
 package com.margelo.nitro.nitroonnxruntime
 
 import android.annotation.SuppressLint
+import android.content.ComponentCallbacks2
 import android.content.Context
+import android.content.res.Configuration
 import android.net.Uri
 import android.util.Log
 import com.facebook.proguard.annotations.DoNotStrip
@@ -27,6 +29,29 @@ class AssetManager : HybridAssetManagerSpec() {
     private const val TAG = "AssetManager"
     private val client = OkHttpClient()
 
+    // Forwards the system's memory warnings to the native memory manager, registered once per process
+    private val memoryCallbacks = object : ComponentCallbacks2 {
+      override fun onTrimMemory(level: Int) {
+        // UI_HIDDEN and BACKGROUND only report that the app left the foreground, not a shortage
+        when (level) {
+          ComponentCallbacks2.TRIM_MEMORY_RUNNING_LOW,
+          ComponentCallbacks2.TRIM_MEMORY_MODERATE -> nativeHandleMemoryPressure(false)
+          ComponentCallbacks2.TRIM_MEMORY_RUNNING_CRITICAL,
+          ComponentCallbacks2.TRIM_MEMORY_COMPLETE -> nativeHandleMemoryPressure(true)
+        }
+      }
+
+      override fun onLowMemory() {
+        nativeHandleMemoryPressure(true)
+      }
+
+      override fun onConfigurationChanged(newConfig: Configuration) {}
+    }
+    private var memoryCallbacksRegistered = false
+
+    @JvmStatic
+    private external fun nativeHandleMemoryPressure(critical: Boolean)
+
     // @SuppressLint("DiscouragedApi")
     // private fun getResourceId(context: Context, name: String): Int {
     //   return context.resources.getIdentifier(
@@ -37,6 +62,21 @@ class AssetManager : HybridAssetManagerSpec() {
     // }
   }
 
+  init {
+    // Hands the AssetManager to native code so that models can be mapped straight from the APK
+    NitroModules.applicationContext?.let { nativeSetAssetManager(it.assets) }
+
+    synchronized(memoryCallbacks) {
+      val context = NitroModules.applicationContext
+      if (!memoryCallbacksRegistered && context != null) {
+        context.applicationContext.registerComponentCallbacks(memoryCallbacks)
+        memoryCallbacksRegistered = true
+      }
+    }
+  }
+
+  private external fun nativeSetAssetManager(assetManager: android.content.res.AssetManager)
+
   override fun copyFile(source: String): Promise<String> {
       return Promise.async {
           try {
@@ -0,0 +1,46 @@
+// Nitro Modules leaves logging and thread naming to the platform, Android and iOS implement them
+// in their own sources. These are the Linux versions for the benchmark.
+
+#include <NitroModules/NitroLogger.hpp>
+#include <NitroModules/ThreadUtils.hpp>
+#include <cstdio>
+#include <pthread.h>
+
+namespace margelo::nitro
+{
+
+  void Logger::nativeLog(LogLevel level, const char *tag, const std::string &message)
+  {
+    const char *levelName = "D";
+    switch (level)
+    {
+    case LogLevel::Debug:
+      levelName = "D";
+      break;
+    case LogLevel::Info:
+      levelName = "I";
+      break;
+    case LogLevel::Warning:
+      levelName = "W";
+      break;
+    case LogLevel::Error:
+      levelName = "E";
+      break;
+    }
+    std::fprintf(stderr, "%s/%s: %s\n", levelName, tag, message.c_str());
+  }
+
+  std::string ThreadUtils::getThreadName()
+  {
+    char name[16] = {};
+    pthread_getname_np(pthread_self(), name, sizeof(name));
+    return name;
+  }
+
+  void ThreadUtils::setThreadName(const std::string &name)
+  {
+    // Linux limits thread names to 15 characters
+    pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+  }
+
+} // namespace margelo::nitro
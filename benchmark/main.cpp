@@ -0,0 +1,164 @@
+// Benchmarks a model through the same InferenceSession code the app uses, on the CPU of a Linux
+// machine, so that performance regressions show up without a device.
+//
+//   nitro-onnxruntime-benchmark model.onnx [--warmup N] [--iterations N] [--threads N] [--dynamic-size N]
+
+#include "InferenceSession.hpp"
+#include "WorkerPool.hpp"
+#include <NitroModules/ArrayBuffer.hpp>
+#include <NitroModules/Promise.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+using namespace margelo::nitro;
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+
+  struct Arguments
+  {
+    std::string modelPath;
+    double warmup = 5;
+    double iterations = 50;
+    int threads = 0;           // 0 lets ONNX Runtime decide
+    int64_t dynamicSize = 1;   // Size of every dynamic dimension of the generated feeds
+  };
+
+  Arguments parseArguments(int argc, char **argv)
+  {
+    Arguments arguments;
+    for (int i = 1; i < argc; i++)
+    {
+      std::string argument = argv[i];
+      auto value = [&]()
+      {
+        if (i + 1 >= argc)
+          throw std::runtime_error(argument + " needs a value");
+        return std::atof(argv[++i]);
+      };
+
+      if (argument == "--warmup")
+        arguments.warmup = value();
+      else if (argument == "--iterations")
+        arguments.iterations = value();
+      else if (argument == "--threads")
+        arguments.threads = static_cast<int>(value());
+      else if (argument == "--dynamic-size")
+        arguments.dynamicSize = static_cast<int64_t>(value());
+      else if (arguments.modelPath.empty())
+        arguments.modelPath = argument;
+      else
+        throw std::runtime_error("Unknown argument: " + argument);
+    }
+    if (arguments.modelPath.empty())
+      throw std::runtime_error("Usage: nitro-onnxruntime-benchmark model.onnx [--warmup N] [--iterations N] "
+                               "[--threads N] [--dynamic-size N]");
+    return arguments;
+  }
+
+  size_t getElementSize(const std::string &type)
+  {
+    if (type == "float64" || type == "int64" || type == "uint64")
+      return 8;
+    if (type == "float32" || type == "int32" || type == "uint32")
+      return 4;
+    if (type == "float16" || type == "bfloat16" || type == "int16" || type == "uint16")
+      return 2;
+    if (type == "int8" || type == "uint8" || type == "bool")
+      return 1;
+    throw std::runtime_error("Inputs of type " + type + " can't be generated");
+  }
+
+  // Random bytes for every input. Integer inputs such as token ids are kept at 0 so that they
+  // are valid indices, floats are drawn from [0, 1).
+  InferenceSession::FeedMap createFeeds(InferenceSession &session, int64_t dynamicSize)
+  {
+    std::mt19937 random(42);
+    std::uniform_real_distribution<float> distribution(0.0f, 1.0f);
+
+    InferenceSession::FeedMap feeds;
+    for (const auto &input : session.getInputNames())
+    {
+      TensorFeed feed;
+      size_t elementCount = 1;
+      for (double dim : input.dims)
+      {
+        double size = dim < 0 ? static_cast<double>(dynamicSize) : dim;
+        feed.dims.push_back(size);
+        elementCount *= static_cast<size_t>(size);
+      }
+
+      size_t byteSize = elementCount * getElementSize(input.type);
+      uint8_t *data = new uint8_t[byteSize]();
+      feed.data = std::make_shared<NativeArrayBuffer>(data, byteSize, [data]()
+                                                      { delete[] data; });
+      if (input.type == "float32")
+      {
+        float *values = reinterpret_cast<float *>(data);
+        for (size_t i = 0; i < elementCount; i++)
+          values[i] = distribution(random);
+      }
+      feeds.emplace(input.name, std::move(feed));
+    }
+    return feeds;
+  }
+
+  // Blocks until the Promise is settled
+  template <typename T>
+  T await(const std::shared_ptr<Promise<T>> &promise)
+  {
+    auto result = std::make_shared<std::promise<T>>();
+    promise->addOnResolvedListener([result](const T &value)
+                                   { result->set_value(value); });
+    promise->addOnRejectedListener([result](const std::exception_ptr &error)
+                                   { result->set_exception(error); });
+    return result->get_future().get();
+  }
+
+} // namespace
+
+int main(int argc, char **argv)
+{
+  try
+  {
+    Arguments arguments = parseArguments(argc, argv);
+
+    Ort::Env env(ORT_LOGGING_LEVEL_WARNING, "Benchmark");
+    Ort::SessionOptions sessionOptions;
+    if (arguments.threads > 0)
+      sessionOptions.SetIntraOpNumThreads(arguments.threads);
+    auto ortSession = std::make_shared<Ort::Session>(env, arguments.modelPath.c_str(), sessionOptions);
+    auto session = std::make_shared<InferenceSession>(ortSession, std::make_shared<WorkerPool>(1));
+
+    BenchmarkOptions options;
+    options.feeds = createFeeds(*session, arguments.dynamicSize);
+    options.warmup = arguments.warmup;
+    options.iterations = arguments.iterations;
+    BenchmarkResult result = await(session->benchmark(options));
+
+    std::printf("model           %s\n", arguments.modelPath.c_str());
+    std::printf("iterations      %.0f\n", result.iterations);
+    std::printf("mean            %.3f ms\n", result.meanMs);
+    std::printf("p50 / p90 / p99 %.3f / %.3f / %.3f ms\n", result.p50Ms, result.p90Ms, result.p99Ms);
+    std::printf("min / max       %.3f / %.3f ms\n", result.minMs, result.maxMs);
+    std::printf("throughput      %.1f runs/s\n", result.throughput);
+    std::printf("tensor creation %.3f ms\n", result.tensorCreationMs);
+    std::printf("run             %.3f ms\n", result.runMs);
+    std::printf("outputs         %.3f ms\n", result.outputMs);
+
+    session->dispose();
+    return 0;
+  }
+  catch (const std::exception &e)
+  {
+    std::fprintf(stderr, "%s\n", e.what());
+    return 1;
+  }
+}
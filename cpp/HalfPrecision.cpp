@@ -0,0 +1,146 @@
+#include "HalfPrecision.hpp"
+#include <cmath>
+#include <cstring>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ONNXRUNTIME_HALF_NEON 1
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    uint32_t toBits(float value)
+    {
+      uint32_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      return bits;
+    }
+
+    float fromBits(uint32_t bits)
+    {
+      float value;
+      std::memcpy(&value, &bits, sizeof(value));
+      return value;
+    }
+
+    // Conversions that let the FPU do the rounding, subnormals included
+    uint16_t floatToHalfScalar(float value)
+    {
+      // Scaling up and back down rounds the mantissa to 10 bits and overflows to infinity
+      float base = (std::fabs(value) * 0x1.0p+112f) * 0x1.0p-110f;
+
+      uint32_t bits = toBits(value);
+      uint32_t shiftedBits = bits + bits;
+      uint32_t sign = bits & 0x80000000u;
+      uint32_t bias = shiftedBits & 0xFF000000u;
+      if (bias < 0x71000000u)
+        bias = 0x71000000u;
+
+      base = fromBits((bias >> 1) + 0x07800000u) + base;
+      uint32_t baseBits = toBits(base);
+      uint32_t exponent = (baseBits >> 13) & 0x00007C00u;
+      uint32_t mantissa = baseBits & 0x00000FFFu;
+      uint32_t magnitude = shiftedBits > 0xFF000000u ? 0x7E00u : exponent + mantissa;
+      return static_cast<uint16_t>((sign >> 16) | magnitude);
+    }
+
+    float halfToFloatScalar(uint16_t half)
+    {
+      uint32_t bits = static_cast<uint32_t>(half) << 16;
+      uint32_t sign = bits & 0x80000000u;
+      uint32_t shiftedBits = bits + bits;
+
+      float normalized = fromBits((shiftedBits >> 4) + (0xE0u << 23)) * 0x1.0p-112f;
+      float denormalized = fromBits((shiftedBits >> 17) | (126u << 23)) - 0.5f;
+      uint32_t magnitude = shiftedBits < (1u << 27) ? toBits(denormalized) : toBits(normalized);
+      return fromBits(sign | magnitude);
+    }
+
+    uint16_t floatToBFloat16Scalar(float value)
+    {
+      uint32_t bits = toBits(value);
+      // Keep NaNs quiet instead of letting the rounding carry turn them into infinity
+      if ((bits & 0x7FFFFFFFu) > 0x7F800000u)
+        return static_cast<uint16_t>((bits >> 16) | 0x0040u);
+      bits += 0x7FFFu + ((bits >> 16) & 1u);
+      return static_cast<uint16_t>(bits >> 16);
+    }
+  } // namespace
+
+  namespace HalfPrecision
+  {
+    void floatToHalf(const float *source, uint16_t *target, size_t count)
+    {
+      size_t i = 0;
+#if defined(ONNXRUNTIME_HALF_NEON) && defined(__aarch64__)
+      for (; i + 4 <= count; i += 4)
+      {
+        vst1_u16(target + i, vreinterpret_u16_f16(vcvt_f16_f32(vld1q_f32(source + i))));
+      }
+#endif
+      for (; i < count; i++)
+      {
+        target[i] = floatToHalfScalar(source[i]);
+      }
+    }
+
+    void halfToFloat(const uint16_t *source, float *target, size_t count)
+    {
+      size_t i = 0;
+#if defined(ONNXRUNTIME_HALF_NEON) && defined(__aarch64__)
+      for (; i + 4 <= count; i += 4)
+      {
+        vst1q_f32(target + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(source + i))));
+      }
+#endif
+      for (; i < count; i++)
+      {
+        target[i] = halfToFloatScalar(source[i]);
+      }
+    }
+
+    void floatToBFloat16(const float *source, uint16_t *target, size_t count)
+    {
+      size_t i = 0;
+#if defined(ONNXRUNTIME_HALF_NEON)
+      const uint32x4_t roundingBias = vdupq_n_u32(0x7FFFu);
+      const uint32x4_t one = vdupq_n_u32(1u);
+      const uint32x4_t quietBit = vdupq_n_u32(0x00400000u);
+      for (; i + 4 <= count; i += 4)
+      {
+        float32x4_t values = vld1q_f32(source + i);
+        uint32x4_t bits = vreinterpretq_u32_f32(values);
+        uint32x4_t lsb = vandq_u32(vshrq_n_u32(bits, 16), one);
+        uint32x4_t rounded = vaddq_u32(bits, vaddq_u32(roundingBias, lsb));
+        // NaN != NaN, those lanes keep their bits with the quiet bit set
+        uint32x4_t isNumber = vceqq_f32(values, values);
+        uint32x4_t result = vbslq_u32(isNumber, rounded, vorrq_u32(bits, quietBit));
+        vst1_u16(target + i, vshrn_n_u32(result, 16));
+      }
+#endif
+      for (; i < count; i++)
+      {
+        target[i] = floatToBFloat16Scalar(source[i]);
+      }
+    }
+
+    void bfloat16ToFloat(const uint16_t *source, float *target, size_t count)
+    {
+      size_t i = 0;
+#if defined(ONNXRUNTIME_HALF_NEON)
+      for (; i + 4 <= count; i += 4)
+      {
+        vst1q_f32(target + i, vreinterpretq_f32_u32(vshll_n_u16(vld1_u16(source + i), 16)));
+      }
+#endif
+      for (; i < count; i++)
+      {
+        target[i] = fromBits(static_cast<uint32_t>(source[i]) << 16);
+      }
+    }
+  } // namespace HalfPrecision
+
+} // namespace margelo::nitro::nitroonnxruntime
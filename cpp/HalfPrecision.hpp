@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Conversions between float32 and the 16-bit float formats half precision models use,
+  // so that JS can keep feeding and reading Float32Arrays. Rounds to nearest even.
+  namespace HalfPrecision
+  {
+    // IEEE 754 binary16
+    void floatToHalf(const float *source, uint16_t *target, size_t count);
+    void halfToFloat(const uint16_t *source, float *target, size_t count);
+
+    // bfloat16, the upper half of a float32
+    void floatToBFloat16(const float *source, uint16_t *target, size_t count);
+    void bfloat16ToFloat(const uint16_t *source, float *target, size_t count);
+  } // namespace HalfPrecision
+
+} // namespace margelo::nitro::nitroonnxruntime
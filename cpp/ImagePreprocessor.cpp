@@ -0,0 +1,391 @@
+#include "ImagePreprocessor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ONNXRUNTIME_PREPROCESS_NEON 1
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    inline uint8_t clampToByte(int value)
+    {
+      return static_cast<uint8_t>(std::min(255, std::max(0, value)));
+    }
+
+#if defined(ONNXRUNTIME_PREPROCESS_NEON)
+    // Widens 16 bytes into 4 vectors of `value * gain + bias`
+    inline void normalize16(uint8x16_t bytes, float32x4_t gain, float32x4_t bias, float32x4_t out[4])
+    {
+      uint16x8_t low = vmovl_u8(vget_low_u8(bytes));
+      uint16x8_t high = vmovl_u8(vget_high_u8(bytes));
+      out[0] = vmlaq_f32(bias, vcvtq_f32_u32(vmovl_u16(vget_low_u16(low))), gain);
+      out[1] = vmlaq_f32(bias, vcvtq_f32_u32(vmovl_u16(vget_high_u16(low))), gain);
+      out[2] = vmlaq_f32(bias, vcvtq_f32_u32(vmovl_u16(vget_low_u16(high))), gain);
+      out[3] = vmlaq_f32(bias, vcvtq_f32_u32(vmovl_u16(vget_high_u16(high))), gain);
+    }
+
+    // Splits 16 packed 3-channel pixels into 4 normalized vectors per channel
+    inline void normalizePixels16(const uint8_t *rgb, const float32x4_t gain[3], const float32x4_t bias[3],
+                                  float32x4_t out[3][4])
+    {
+      uint8x16x3_t pixels = vld3q_u8(rgb);
+      for (int c = 0; c < 3; c++)
+        normalize16(pixels.val[c], gain[c], bias[c], out[c]);
+    }
+
+    inline void normalizePixels16(const uint16_t *rgb, const float32x4_t gain[3], const float32x4_t bias[3],
+                                  float32x4_t out[3][4])
+    {
+      for (int half = 0; half < 2; half++)
+      {
+        uint16x8x3_t pixels = vld3q_u16(rgb + half * 24);
+        for (int c = 0; c < 3; c++)
+        {
+          out[c][half * 2] = vmlaq_f32(bias[c], vcvtq_f32_u32(vmovl_u16(vget_low_u16(pixels.val[c]))), gain[c]);
+          out[c][half * 2 + 1] = vmlaq_f32(bias[c], vcvtq_f32_u32(vmovl_u16(vget_high_u16(pixels.val[c]))), gain[c]);
+        }
+      }
+    }
+#endif
+  } // namespace
+
+  ImagePreprocessor::ImagePreprocessor(const Config &config) : config_(config)
+  {
+    if (config_.sourceWidth == 0 || config_.sourceHeight == 0)
+      throw std::runtime_error("Source width and height must be positive");
+    if (config_.targetWidth == 0 || config_.targetHeight == 0)
+      throw std::runtime_error("Target width and height must be positive");
+
+    for (int c = 0; c < 3; c++)
+    {
+      if (config_.std[c] == 0.0f)
+        throw std::runtime_error("std must not contain 0");
+      gain_[c] = config_.scale / config_.std[c];
+      bias_[c] = -config_.mean[c] / config_.std[c];
+    }
+
+    columns_ = buildSamples(config_.sourceWidth, config_.targetWidth);
+    rows_ = buildSamples(config_.sourceHeight, config_.targetHeight);
+  }
+
+  ImagePreprocessor::PixelFormat ImagePreprocessor::parseFormat(const std::string &format)
+  {
+    if (format == "rgba")
+      return PixelFormat::RGBA;
+    if (format == "bgra")
+      return PixelFormat::BGRA;
+    if (format == "rgb")
+      return PixelFormat::RGB;
+    if (format == "bgr")
+      return PixelFormat::BGR;
+    if (format == "nv21")
+      return PixelFormat::NV21;
+    throw std::runtime_error("Unsupported pixel format: " + format);
+  }
+
+  size_t ImagePreprocessor::rowSize(PixelFormat format, size_t width)
+  {
+    switch (format)
+    {
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA:
+      return width * 4;
+    case PixelFormat::RGB:
+    case PixelFormat::BGR:
+      return width * 3;
+    case PixelFormat::NV21:
+      return width;
+    }
+    return 0;
+  }
+
+  size_t ImagePreprocessor::frameSize(PixelFormat format, size_t width, size_t height, size_t bytesPerRow, size_t uvOffset)
+  {
+    size_t stride = bytesPerRow > 0 ? bytesPerRow : rowSize(format, width);
+    if (format != PixelFormat::NV21)
+      return stride * height;
+
+    // Interleaved V/U rows at half resolution, below the luma plane unless placed elsewhere
+    size_t chromaStride = bytesPerRow > 0 ? bytesPerRow : 2 * ((width + 1) / 2);
+    size_t chromaOffset = uvOffset > 0 ? uvOffset : stride * height;
+    return chromaOffset + chromaStride * ((height + 1) / 2);
+  }
+
+  std::vector<int64_t> ImagePreprocessor::outputShape() const
+  {
+    int64_t height = static_cast<int64_t>(config_.targetHeight);
+    int64_t width = static_cast<int64_t>(config_.targetWidth);
+    if (config_.planar)
+      return {1, 3, height, width};
+    return {1, height, width, 3};
+  }
+
+  std::vector<ImagePreprocessor::Sample> ImagePreprocessor::buildSamples(size_t source, size_t target)
+  {
+    // Half-pixel centers, matching the usual resize of training pipelines
+    std::vector<Sample> samples(target);
+    float ratio = static_cast<float>(source) / static_cast<float>(target);
+    for (size_t i = 0; i < target; i++)
+    {
+      float position = std::max(0.0f, (static_cast<float>(i) + 0.5f) * ratio - 0.5f);
+      uint32_t first = static_cast<uint32_t>(position);
+      if (first >= source - 1)
+      {
+        samples[i] = {static_cast<uint32_t>(source - 1), static_cast<uint32_t>(source - 1), 0};
+        continue;
+      }
+      uint32_t weight = std::min<uint32_t>(256, static_cast<uint32_t>((position - first) * 256.0f + 0.5f));
+      samples[i] = {first, first + 1, weight};
+    }
+    return samples;
+  }
+
+  void ImagePreprocessor::convertRow(const uint8_t *frame, size_t width, size_t chromaOffset, size_t bytesPerRow, size_t y,
+                                     uint8_t *rgb) const
+  {
+    const size_t stride = bytesPerRow > 0 ? bytesPerRow : rowSize(config_.format, width);
+    // Output indices of red and blue, green always stays in the middle
+    const int red = config_.bgr ? 2 : 0;
+    const int blue = config_.bgr ? 0 : 2;
+
+    switch (config_.format)
+    {
+    case PixelFormat::RGBA:
+    case PixelFormat::BGRA:
+    {
+      const uint8_t *source = frame + y * stride;
+      // Swap red and blue when the frame and the tensor disagree on the order
+      bool swap = (config_.format == PixelFormat::BGRA) != config_.bgr;
+      size_t x = 0;
+#if defined(ONNXRUNTIME_PREPROCESS_NEON)
+      for (; x + 16 <= width; x += 16)
+      {
+        uint8x16x4_t pixels = vld4q_u8(source + x * 4);
+        uint8x16x3_t packed;
+        packed.val[0] = swap ? pixels.val[2] : pixels.val[0];
+        packed.val[1] = pixels.val[1];
+        packed.val[2] = swap ? pixels.val[0] : pixels.val[2];
+        vst3q_u8(rgb + x * 3, packed);
+      }
+#endif
+      for (; x < width; x++)
+      {
+        const uint8_t *pixel = source + x * 4;
+        rgb[x * 3 + 0] = swap ? pixel[2] : pixel[0];
+        rgb[x * 3 + 1] = pixel[1];
+        rgb[x * 3 + 2] = swap ? pixel[0] : pixel[2];
+      }
+      break;
+    }
+    case PixelFormat::RGB:
+    case PixelFormat::BGR:
+    {
+      const uint8_t *source = frame + y * stride;
+      bool swap = (config_.format == PixelFormat::BGR) != config_.bgr;
+      for (size_t x = 0; x < width; x++)
+      {
+        const uint8_t *pixel = source + x * 3;
+        rgb[x * 3 + 0] = swap ? pixel[2] : pixel[0];
+        rgb[x * 3 + 1] = pixel[1];
+        rgb[x * 3 + 2] = swap ? pixel[0] : pixel[2];
+      }
+      break;
+    }
+    case PixelFormat::NV21:
+    {
+      // BT.601 limited range, as produced by Android cameras
+      const size_t chromaStride = bytesPerRow > 0 ? bytesPerRow : 2 * ((width + 1) / 2);
+      const uint8_t *luma = frame + y * stride;
+      const uint8_t *chroma = frame + chromaOffset + (y / 2) * chromaStride;
+      for (size_t x = 0; x < width; x++)
+      {
+        int c = 298 * (static_cast<int>(luma[x]) - 16);
+        int v = static_cast<int>(chroma[(x / 2) * 2]) - 128;
+        int u = static_cast<int>(chroma[(x / 2) * 2 + 1]) - 128;
+        rgb[x * 3 + red] = clampToByte((c + 409 * v + 128) >> 8);
+        rgb[x * 3 + 1] = clampToByte((c - 100 * u - 208 * v + 128) >> 8);
+        rgb[x * 3 + blue] = clampToByte((c + 516 * u + 128) >> 8);
+      }
+      break;
+    }
+    }
+  }
+
+  template <typename Pixel>
+  void ImagePreprocessor::storeRow(const Pixel *rgb, size_t y, float *output) const
+  {
+    // Resized values carry 8 fractional bits
+    const float unit = std::is_same_v<Pixel, uint16_t> ? 1.0f / 256.0f : 1.0f;
+    const float gain[3] = {gain_[0] * unit, gain_[1] * unit, gain_[2] * unit};
+    const size_t width = config_.targetWidth;
+    size_t x = 0;
+#if defined(ONNXRUNTIME_PREPROCESS_NEON)
+    const float32x4_t gains[3] = {vdupq_n_f32(gain[0]), vdupq_n_f32(gain[1]), vdupq_n_f32(gain[2])};
+    const float32x4_t biases[3] = {vdupq_n_f32(bias_[0]), vdupq_n_f32(bias_[1]), vdupq_n_f32(bias_[2])};
+#endif
+
+    if (config_.planar)
+    {
+      const size_t plane = width * config_.targetHeight;
+      float *channels[3] = {output + y * width, output + plane + y * width, output + 2 * plane + y * width};
+#if defined(ONNXRUNTIME_PREPROCESS_NEON)
+      for (; x + 16 <= width; x += 16)
+      {
+        float32x4_t values[3][4];
+        normalizePixels16(rgb + x * 3, gains, biases, values);
+        for (int c = 0; c < 3; c++)
+        {
+          for (int i = 0; i < 4; i++)
+            vst1q_f32(channels[c] + x + i * 4, values[c][i]);
+        }
+      }
+#endif
+      for (; x < width; x++)
+      {
+        for (int c = 0; c < 3; c++)
+          channels[c][x] = rgb[x * 3 + c] * gain[c] + bias_[c];
+      }
+      return;
+    }
+
+    float *row = output + y * width * 3;
+#if defined(ONNXRUNTIME_PREPROCESS_NEON)
+    for (; x + 16 <= width; x += 16)
+    {
+      float32x4_t values[3][4];
+      normalizePixels16(rgb + x * 3, gains, biases, values);
+      for (int i = 0; i < 4; i++)
+      {
+        float32x4x3_t interleaved = {{values[0][i], values[1][i], values[2][i]}};
+        vst3q_f32(row + (x + i * 4) * 3, interleaved);
+      }
+    }
+#endif
+    for (; x < width; x++)
+    {
+      for (int c = 0; c < 3; c++)
+        row[x * 3 + c] = rgb[x * 3 + c] * gain[c] + bias_[c];
+    }
+  }
+
+  void ImagePreprocessor::process(const uint8_t *frame, size_t frameByteSize, size_t width, size_t height,
+                                  size_t bytesPerRow, size_t uvOffset, float *output) const
+  {
+    if (width == 0 || height == 0)
+      throw std::runtime_error("Frame width and height must be positive");
+    const std::string size = std::to_string(width) + "x" + std::to_string(height);
+    const size_t stride = bytesPerRow > 0 ? bytesPerRow : rowSize(config_.format, width);
+    if (uvOffset > 0)
+    {
+      if (config_.format != PixelFormat::NV21)
+        throw std::runtime_error("uvOffset only applies to nv21 frames");
+      if (uvOffset < stride * (height - 1) + width)
+        throw std::runtime_error("uvOffset " + std::to_string(uvOffset) + " overlaps the Y plane of " + size);
+    }
+    if (bytesPerRow == 0)
+    {
+      // Without a stride a frame of any other size would be read with the wrong row offsets
+      size_t expected = frameSize(config_.format, width, height, 0, uvOffset);
+      if (frameByteSize != expected)
+        throw std::runtime_error("Frame is " + std::to_string(frameByteSize) + " bytes, expected " + std::to_string(expected) +
+                                 " for " + size + ", pass bytesPerRow if its rows are padded");
+    }
+    else
+    {
+      size_t lastRow = config_.format == PixelFormat::NV21 ? 2 * ((width + 1) / 2) : rowSize(config_.format, width);
+      if (bytesPerRow < std::max(lastRow, rowSize(config_.format, width)))
+        throw std::runtime_error("bytesPerRow " + std::to_string(bytesPerRow) + " is less than a row of " + size);
+      // The padding after the last row may be left out
+      size_t full = frameSize(config_.format, width, height, bytesPerRow, uvOffset);
+      if (frameByteSize > full || frameByteSize < full - (bytesPerRow - lastRow))
+        throw std::runtime_error("Frame is " + std::to_string(frameByteSize) + " bytes, expected " + std::to_string(full) +
+                                 " for " + size + " with " + std::to_string(bytesPerRow) + " bytes per row");
+    }
+
+    const size_t targetWidth = config_.targetWidth;
+    const size_t targetHeight = config_.targetHeight;
+
+    // Frames of a different size than configured get their own sampling tables
+    std::vector<Sample> frameColumns;
+    std::vector<Sample> frameRows;
+    const std::vector<Sample> *columns = &columns_;
+    const std::vector<Sample> *rows = &rows_;
+    if (width != config_.sourceWidth)
+    {
+      frameColumns = buildSamples(width, targetWidth);
+      columns = &frameColumns;
+    }
+    if (height != config_.sourceHeight)
+    {
+      frameRows = buildSamples(height, targetHeight);
+      rows = &frameRows;
+    }
+
+    const size_t chromaOffset = uvOffset > 0 ? uvOffset : stride * height;
+    if (width == targetWidth && height == targetHeight)
+    {
+      std::vector<uint8_t> converted(targetWidth * 3);
+      for (size_t y = 0; y < targetHeight; y++)
+      {
+        convertRow(frame, width, chromaOffset, bytesPerRow, y, converted.data());
+        storeRow(converted.data(), y, output);
+      }
+      return;
+    }
+
+    // The two source rows around the current target row, converted once and reused while
+    // consecutive target rows sample the same source rows
+    std::vector<uint8_t> upper(width * 3);
+    std::vector<uint8_t> lower(width * 3);
+    int64_t upperRow = -1;
+    int64_t lowerRow = -1;
+    // Kept in 8.8 fixed point, so that normalizing doesn't start from a value rounded to a byte
+    std::vector<uint16_t> resized(targetWidth * 3);
+
+    for (size_t y = 0; y < targetHeight; y++)
+    {
+      const Sample &row = (*rows)[y];
+      if (upperRow != row.first)
+      {
+        if (lowerRow == row.first)
+        {
+          std::swap(upper, lower);
+          std::swap(upperRow, lowerRow);
+        }
+        else
+        {
+          convertRow(frame, width, chromaOffset, bytesPerRow, row.first, upper.data());
+          upperRow = row.first;
+        }
+      }
+      if (lowerRow != row.second)
+      {
+        convertRow(frame, width, chromaOffset, bytesPerRow, row.second, lower.data());
+        lowerRow = row.second;
+      }
+
+      // Bilinear blend in 8.8 fixed point
+      const uint32_t rowWeight = row.weight;
+      for (size_t x = 0; x < targetWidth; x++)
+      {
+        const Sample &column = (*columns)[x];
+        const uint32_t columnWeight = column.weight;
+        for (int c = 0; c < 3; c++)
+        {
+          uint32_t top = upper[column.first * 3 + c] * (256 - columnWeight) + upper[column.second * 3 + c] * columnWeight;
+          uint32_t bottom = lower[column.first * 3 + c] * (256 - columnWeight) + lower[column.second * 3 + c] * columnWeight;
+          resized[x * 3 + c] = static_cast<uint16_t>((top * (256 - rowWeight) + bottom * rowWeight + 128) >> 8);
+        }
+      }
+      storeRow(resized.data(), y, output);
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
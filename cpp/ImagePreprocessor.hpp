@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Converts camera frames / decoded images into a normalized float32 input tensor in one pass:
+  // pixel format conversion, bilinear resize, channel order, mean/std normalization and layout.
+  class ImagePreprocessor
+  {
+  public:
+    enum class PixelFormat
+    {
+      RGBA,
+      BGRA,
+      RGB,
+      BGR,
+      NV21 // Android camera default, full-resolution Y plane followed by interleaved V/U at half resolution
+    };
+
+    struct Config
+    {
+      PixelFormat format = PixelFormat::RGBA;
+      size_t sourceWidth = 0;
+      size_t sourceHeight = 0;
+      size_t bytesPerRow = 0; // Row stride of frames of the source size, 0 for tightly packed rows
+      size_t uvOffset = 0;    // NV21 offset of the V/U plane in frames of the source size, 0 right after the Y plane
+      size_t targetWidth = 0;
+      size_t targetHeight = 0;
+      bool planar = true; // NCHW when true, NHWC otherwise
+      bool bgr = false;   // Channel order of the tensor
+      float scale = 1.0f / 255.0f;
+      float mean[3] = {0.0f, 0.0f, 0.0f};
+      float std[3] = {1.0f, 1.0f, 1.0f};
+    };
+
+    explicit ImagePreprocessor(const Config &config);
+
+    static PixelFormat parseFormat(const std::string &format);
+    // Bytes a frame of the given size takes in `format`. With a row stride every row takes
+    // `bytesPerRow` bytes, for NV21 the rows of both planes. A `uvOffset` places the NV21 V/U plane.
+    static size_t frameSize(PixelFormat format, size_t width, size_t height, size_t bytesPerRow = 0, size_t uvOffset = 0);
+
+    const Config &config() const { return config_; }
+    // Tensor shape with a batch of 1, [1, 3, H, W] or [1, H, W, 3]
+    std::vector<int64_t> outputShape() const;
+
+    // Writes the preprocessed frame into `output`, which holds targetWidth * targetHeight * 3 floats.
+    // `bytesPerRow` is the frame's row stride, 0 for tightly packed rows. `uvOffset` is where an NV21
+    // frame's V/U plane starts, 0 right after the Y plane. Safe to call from several threads at once.
+    void process(const uint8_t *frame, size_t frameByteSize, size_t width, size_t height, size_t bytesPerRow,
+                 size_t uvOffset, float *output) const;
+
+  private:
+    // Source column pair and 8-bit weight of the second one, per target column or row
+    struct Sample
+    {
+      uint32_t first;
+      uint32_t second;
+      uint32_t weight;
+    };
+
+    Config config_;
+    // Per-channel `value * gain + bias`, folding scale, mean and std together
+    float gain_[3];
+    float bias_[3];
+    // Horizontal and vertical sampling tables for the configured source size
+    std::vector<Sample> columns_;
+    std::vector<Sample> rows_;
+
+    static std::vector<Sample> buildSamples(size_t source, size_t target);
+    // Bytes of one row without padding, for NV21 of the luma plane
+    static size_t rowSize(PixelFormat format, size_t width);
+    // Converts one source row into packed 3-channel pixels in the tensor's channel order.
+    // `chromaOffset` is where the NV21 V/U plane starts.
+    void convertRow(const uint8_t *frame, size_t width, size_t chromaOffset, size_t bytesPerRow, size_t y, uint8_t *rgb) const;
+    // Normalizes one row of packed 3-channel pixels into the output tensor, either bytes or the
+    // 8.8 fixed-point values of the resize
+    template <typename Pixel>
+    void storeRow(const Pixel *rgb, size_t y, float *output) const;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -1,8 +1,24 @@
 #include "InferenceSession.hpp"
+#include "HalfPrecision.hpp"
+#include "MemoryManager.hpp"
+#include "Sampler.hpp"
+#include "StateShape.hpp"
 #include <NitroModules/Promise.hpp>
 #include <NitroModules/ArrayBuffer.hpp>
+#include <NitroModules/NitroLogger.hpp>
 #include <stdexcept>
 #include <cstring>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <mutex>
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__APPLE__)
+#include <mach/mach.h>
+#endif
 
 namespace margelo::nitro::nitroonnxruntime
 {
@@ -26,62 +42,132 @@ namespace margelo::nitro::nitroonnxruntime
       return "bool";
     case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE:
       return "float64";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+      return "float16";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16:
+      return "bfloat16";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16:
+      return "uint16";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT32:
+      return "uint32";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT64:
+      return "uint64";
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING:
+      return "string";
+    default:
+      throw std::runtime_error("Unsupported tensor type: " + std::to_string(type));
+    }
+  }
+
+  size_t getElementSize(ONNXTensorElementDataType type)
+  {
+    switch (type)
+    {
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT:
+      return sizeof(float);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8:
+      return sizeof(uint8_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT8:
+      return sizeof(int8_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT16:
+      return sizeof(int16_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+      return sizeof(int32_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+      return sizeof(int64_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BOOL:
+      return sizeof(bool);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_DOUBLE:
+      return sizeof(double);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16:
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT16:
+      return sizeof(uint16_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT32:
+      return sizeof(uint32_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT64:
+      return sizeof(uint64_t);
+    case ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING:
+      // Variable length, strings are converted element by element instead
+      return 0;
     default:
       throw std::runtime_error("Unsupported tensor type: " + std::to_string(type));
     }
   }
 
+  bool isHalfPrecision(ONNXTensorElementDataType type)
+  {
+    return type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16 || type == ONNX_TENSOR_ELEMENT_DATA_TYPE_BFLOAT16;
+  }
+
+  InferenceSession::TensorPlan createTensorPlan(const char *name, const Ort::TypeInfo &info)
+  {
+    auto tensorInfo = info.GetTensorTypeAndShapeInfo();
+
+    InferenceSession::TensorPlan plan;
+    plan.name = name;
+    plan.type = tensorInfo.GetElementType();
+    plan.elementSize = getElementSize(plan.type);
+    plan.dims = tensorInfo.GetShape();
+    std::vector<const char *> symbolicDims(plan.dims.size());
+    tensorInfo.GetSymbolicDimensions(symbolicDims.data(), symbolicDims.size());
+    plan.symbolicDims.assign(symbolicDims.begin(), symbolicDims.end());
+    for (size_t i = 0; i < plan.dims.size(); i++)
+    {
+      if (plan.dims[i] < 0)
+      {
+        plan.dynamicDim = plan.dynamicDimCount == 0 ? static_cast<int>(i) : -1;
+        plan.dynamicDimCount++;
+      }
+      else
+      {
+        plan.fixedElements *= plan.dims[i];
+      }
+    }
+    return plan;
+  }
+
+  Tensor toTensor(const InferenceSession::TensorPlan &plan)
+  {
+    std::vector<double> dims_double(plan.dims.begin(), plan.dims.end());
+    return Tensor(dims_double, getTypeString(plan.type), plan.name);
+  }
+
   void InferenceSession::initializeIONames()
   {
     Ort::AllocatorWithDefaultOptions allocator;
+    memoryInfo_ = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
 
     // Get input names
     size_t numInputs = session_->GetInputCount();
     inputNames_.reserve(numInputs);
+    inputPlans_.reserve(numInputs);
     for (size_t i = 0; i < numInputs; i++)
     {
       auto input_name = session_->GetInputNameAllocated(i, allocator);
-      auto info = session_->GetInputTypeInfo(i);
-      auto tensorInfo = info.GetTensorTypeAndShapeInfo();
-      auto dims = tensorInfo.GetShape();
-      std::vector<double> dims_double(dims.begin(), dims.end());
-
-      // Get actual type from model
-      std::string type = getTypeString(tensorInfo.GetElementType());
-
-      inputNames_.emplace_back(dims_double, type, input_name.get());
+      inputPlans_.push_back(createTensorPlan(input_name.get(), session_->GetInputTypeInfo(i)));
+      inputIndex_.emplace(inputPlans_.back().name, i);
+      inputNames_.push_back(toTensor(inputPlans_.back()));
     }
 
     // Get output names
     size_t numOutputs = session_->GetOutputCount();
     outputNames_.reserve(numOutputs);
+    outputPlans_.reserve(numOutputs);
     for (size_t i = 0; i < numOutputs; i++)
     {
       auto output_name = session_->GetOutputNameAllocated(i, allocator);
-      auto info = session_->GetOutputTypeInfo(i);
-      auto tensorInfo = info.GetTensorTypeAndShapeInfo();
-      auto dims = tensorInfo.GetShape();
-      std::vector<double> dims_double(dims.begin(), dims.end());
-
-      // Get actual type from model
-      std::string type = getTypeString(tensorInfo.GetElementType());
-
-      outputNames_.emplace_back(dims_double, type, output_name.get());
+      outputPlans_.push_back(createTensorPlan(output_name.get(), session_->GetOutputTypeInfo(i)));
+      outputIndex_.emplace(outputPlans_.back().name, i);
+      outputNames_.push_back(toTensor(outputPlans_.back()));
     }
-  }
 
-  template <typename T>
-  Ort::Value createTensor(Ort::MemoryInfo &memoryInfo, const void *data, size_t byteSize,
-                          const std::vector<int64_t> &dims)
-  {
-    T *buffer = new T[byteSize / sizeof(T)];
-    std::memcpy(buffer, data, byteSize);
-    return Ort::Value::CreateTensor<T>(
-        memoryInfo,
-        buffer,
-        byteSize / sizeof(T),
-        dims.data(),
-        dims.size());
+    // Names only point into the plans, which are not modified after this point
+    outputNamesC_.reserve(numOutputs);
+    for (const auto &plan : outputPlans_)
+    {
+      outputNamesC_.push_back(plan.name.c_str());
+    }
   }
 
   std::vector<Tensor> InferenceSession::getInputNames()
@@ -94,280 +180,1855 @@ namespace margelo::nitro::nitroonnxruntime
     return outputNames_;
   }
 
-  // Helper function to resolve dynamic dimensions
-  std::vector<int64_t> resolveDynamicDimensions(const std::vector<double> &model_dims,
-                                                const std::vector<int64_t> &input_shape)
+  const InferenceSession::TensorPlan &InferenceSession::getInputPlan(const std::string &name) const
+  {
+    auto it = inputIndex_.find(name);
+    if (it == inputIndex_.end())
+    {
+      throw std::runtime_error("Input name not found: " + name);
+    }
+    return inputPlans_[it->second];
+  }
+
+  const InferenceSession::TensorPlan &InferenceSession::getOutputPlan(const std::string &name) const
+  {
+    auto it = outputIndex_.find(name);
+    if (it == outputIndex_.end())
+    {
+      throw std::runtime_error("Output name not found: " + name);
+    }
+    return outputPlans_[it->second];
+  }
+
+  // Resolves the concrete shape of a feed, either from the explicitly passed dims or by inferring
+  // the single dynamic dimension from the buffer size. For string tensors `byteSize` is the number of strings.
+  std::vector<int64_t> resolveShape(const InferenceSession::TensorPlan &plan, size_t byteSize,
+                                    const std::vector<int64_t> &explicitDims)
   {
-    std::vector<int64_t> resolved_dims(model_dims.size());
+    bool strings = plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING;
+    size_t elementSize = strings ? 1 : plan.elementSize;
+    std::string unit = strings ? " strings" : " bytes";
 
-    // If input shape is provided and matches the model dimensions count
-    if (!input_shape.empty() && model_dims.size() == input_shape.size())
+    if (!explicitDims.empty())
     {
-      for (size_t i = 0; i < model_dims.size(); ++i)
+      if (explicitDims.size() != plan.dims.size())
       {
-        if (model_dims[i] < 0)
-        { // Dynamic dimension
-          // Use the concrete value from the input shape
-          resolved_dims[i] = input_shape[i];
-        }
-        else
+        throw std::runtime_error("'" + plan.name + "' expects " + std::to_string(plan.dims.size()) +
+                                 " dimensions but " + std::to_string(explicitDims.size()) + " were passed");
+      }
+      size_t elementCount = 1;
+      for (size_t i = 0; i < explicitDims.size(); i++)
+      {
+        if (plan.dims[i] >= 0 && plan.dims[i] != explicitDims[i])
         {
-          // Use the model's fixed dimension
-          resolved_dims[i] = static_cast<int64_t>(model_dims[i]);
+          throw std::runtime_error("Dimension " + std::to_string(i) + " of '" + plan.name + "' is fixed to " +
+                                   std::to_string(plan.dims[i]) + " but " + std::to_string(explicitDims[i]) + " was passed");
         }
+        elementCount *= static_cast<size_t>(explicitDims[i]);
+      }
+      if (elementCount * elementSize != byteSize)
+      {
+        throw std::runtime_error("Buffer of '" + plan.name + "' has " + std::to_string(byteSize) + unit +
+                                 " but its dims require " + std::to_string(elementCount * elementSize));
       }
+      return explicitDims;
     }
-    else
+
+    std::vector<int64_t> shape = plan.dims;
+    size_t fixedBytes = static_cast<size_t>(plan.fixedElements) * elementSize;
+    if (plan.dynamicDimCount == 0)
+    {
+      if (byteSize != fixedBytes)
+      {
+        throw std::runtime_error("Buffer of '" + plan.name + "' has " + std::to_string(byteSize) + unit +
+                                 " but its shape requires " + std::to_string(fixedBytes));
+      }
+    }
+    else if (plan.dynamicDimCount == 1)
     {
-      // Fallback: if input_shape is not provided or doesn't match, handle dynamic dims with default values
-      for (size_t i = 0; i < model_dims.size(); ++i)
+      // Exactly one dynamic dimension, infer its size from the buffer size
+      if (fixedBytes == 0 || byteSize % fixedBytes != 0)
       {
-        if (model_dims[i] < 0)
+        throw std::runtime_error("Buffer of '" + plan.name + "' has " + std::to_string(byteSize) + unit +
+                                 ", which is not a multiple of " + std::to_string(fixedBytes));
+      }
+      shape[plan.dynamicDim] = static_cast<int64_t>(byteSize / fixedBytes);
+    }
+    else
+    {
+      throw std::runtime_error("'" + plan.name + "' has " + std::to_string(plan.dynamicDimCount) +
+                               " dynamic dimensions, pass its dims explicitly or fix them with freeDimensionOverrides");
+    }
+    return shape;
+  }
+
+  // Wraps `data` as a tensor for a model input or output without copying it. Ort::Value does not
+  // take ownership of user memory, so the caller has to keep `data` alive until the run has finished.
+  Ort::Value createTensor(const InferenceSession::TensorPlan &plan, const Ort::MemoryInfo &memoryInfo,
+                          uint8_t *data, size_t byteSize, const std::vector<int64_t> &explicitDims)
+  {
+    std::vector<int64_t> shape = resolveShape(plan, byteSize, explicitDims);
+    return Ort::Value::CreateTensor(memoryInfo, data, byteSize, shape.data(), shape.size(), plan.type);
+  }
+
+  std::shared_ptr<ArrayBuffer> allocateArrayBuffer(size_t byteSize)
+  {
+    uint8_t *data = new uint8_t[byteSize];
+    return std::make_shared<margelo::nitro::NativeArrayBuffer>(
+        data,
+        byteSize,
+        [data]()
         {
-          // Default batch size to 1 for dynamic batch dimension (typically the first dimension)
-          resolved_dims[i] = (i == 0) ? 1 : 1;
-        }
-        else
+          delete[] data;
+        });
+  }
+
+  // Hand a native result to JS, the buffer owns the vector until it is garbage collected
+  std::shared_ptr<ArrayBuffer> wrapArrayBuffer(std::vector<uint8_t> &&bytes)
+  {
+    auto *owned = new std::vector<uint8_t>(std::move(bytes));
+    return std::make_shared<margelo::nitro::NativeArrayBuffer>(
+        owned->data(),
+        owned->size(),
+        [owned]()
         {
-          resolved_dims[i] = static_cast<int64_t>(model_dims[i]);
-        }
-      }
+          delete owned;
+        });
+  }
+
+  // Copy a buffer into native memory that can be safely read from any thread
+  std::shared_ptr<ArrayBuffer> copyArrayBuffer(const std::shared_ptr<ArrayBuffer> &buffer)
+  {
+    auto copy = allocateArrayBuffer(buffer->size());
+    std::memcpy(copy->data(), buffer->data(), buffer->size());
+    return copy;
+  }
+
+  // String tensors cross the JS boundary as UTF-8 strings, each one terminated by a NUL byte.
+  // The returned pointers point into `data`.
+  std::vector<const char *> splitStrings(const std::string &name, const uint8_t *data, size_t byteSize)
+  {
+    if (byteSize > 0 && data[byteSize - 1] != '\0')
+    {
+      throw std::runtime_error("Strings fed to '" + name + "' must each end with a NUL byte");
     }
 
-    return resolved_dims;
+    std::vector<const char *> strings;
+    const char *begin = reinterpret_cast<const char *>(data);
+    const char *end = begin + byteSize;
+    for (const char *string = begin; string < end; string += std::strlen(string) + 1)
+    {
+      strings.push_back(string);
+    }
+    return strings;
   }
 
-  std::shared_ptr<Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>> InferenceSession::run(
-      const std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> &feeds)
+  std::shared_ptr<ArrayBuffer> joinStrings(const Ort::Value &value)
   {
-    auto promise = Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>::create();
+    size_t count = value.GetTensorTypeAndShapeInfo().GetElementCount();
+    size_t contentSize = value.GetStringTensorDataLength();
+    std::vector<char> content(contentSize);
+    std::vector<size_t> offsets(count);
+    value.GetStringTensorContent(content.data(), contentSize, offsets.data(), count);
 
-    try
+    auto buffer = allocateArrayBuffer(contentSize + count);
+    uint8_t *target = buffer->data();
+    for (size_t i = 0; i < count; i++)
+    {
+      size_t length = (i + 1 < count ? offsets[i + 1] : contentSize) - offsets[i];
+      std::memcpy(target, content.data() + offsets[i], length);
+      target[length] = '\0';
+      target += length + 1;
+    }
+    return buffer;
+  }
+
+  // Size in bytes of a single entry along the batch (first) dimension
+  size_t getBatchEntrySize(const InferenceSession::TensorPlan &plan)
+  {
+    if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING)
+    {
+      throw std::runtime_error("'" + plan.name + "' is a string tensor, it can't be batched");
+    }
+    if (plan.dims.empty() || plan.dims[0] >= 0)
     {
-      Ort::MemoryInfo memoryInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
-      std::vector<const char *> inputNames;
-      std::vector<Ort::Value> inputTensors;
+      throw std::runtime_error("'" + plan.name + "' has no dynamic batch dimension, it can't be batched");
+    }
+    if (plan.dynamicDimCount > 1)
+    {
+      throw std::runtime_error("'" + plan.name + "' has dynamic dimensions besides the batch dimension, it can't be batched");
+    }
+    return plan.elementSize * static_cast<size_t>(plan.fixedElements);
+  }
+
+  bool InferenceSession::getZeroCopyInputs()
+  {
+    return zeroCopyInputs_;
+  }
+
+  void InferenceSession::setZeroCopyInputs(bool zeroCopyInputs)
+  {
+    zeroCopyInputs_ = zeroCopyInputs;
+  }
+
+  bool InferenceSession::getConvertHalfPrecision()
+  {
+    return convertHalfPrecision_;
+  }
+
+  void InferenceSession::setConvertHalfPrecision(bool convertHalfPrecision)
+  {
+    convertHalfPrecision_ = convertHalfPrecision;
+  }
 
-      // Prepare inputs
-      for (const auto &[name, buffer] : feeds)
+  std::vector<int64_t> toShape(const std::vector<double> &dims)
+  {
+    std::vector<int64_t> shape;
+    shape.reserve(dims.size());
+    for (double dim : dims)
+    {
+      if (dim < 0 || dim != static_cast<double>(static_cast<int64_t>(dim)))
       {
-        inputNames.push_back(name.c_str());
+        throw std::runtime_error("Invalid tensor dimension: " + std::to_string(dim));
+      }
+      shape.push_back(static_cast<int64_t>(dim));
+    }
+    return shape;
+  }
 
-        // Since this is a non-owning buffer from JS, we need to access it safely within the sync call
-        const void *data = buffer->data();
-        size_t byteSize = buffer->size();
+  // State a sequence starts from, of the shape initialStateShape() picks. It is empty along the
+  // past sequence length, fixed-size states such as recurrent hidden states are zeroed.
+  Ort::Value createInitialState(const InferenceSession::TensorPlan &plan, const std::vector<int64_t> &shape)
+  {
+    Ort::AllocatorWithDefaultOptions allocator;
+    auto value = Ort::Value::CreateTensor(allocator, shape.data(), shape.size(), plan.type);
+    size_t byteSize = value.GetTensorTypeAndShapeInfo().GetElementCount() * plan.elementSize;
+    if (byteSize > 0)
+    {
+      std::memset(value.GetTensorMutableRawData(), 0, byteSize);
+    }
+    return value;
+  }
 
-        // Find corresponding input tensor info
-        auto it = std::find_if(inputNames_.begin(), inputNames_.end(),
-                               [&name](const Tensor &t)
-                               { return t.name == name; });
-        if (it == inputNames_.end())
-        {
-          throw std::runtime_error("Input name not found: " + name);
-        }
+  // Counts a run in activeRuns_, or a generation in generations_, for as long as it is in scope
+  class ActiveRunScope
+  {
+  public:
+    explicit ActiveRunScope(std::atomic<uint32_t> &activeRuns) : activeRuns_(activeRuns), previous_(activeRuns.fetch_add(1)) {}
+    ~ActiveRunScope() { activeRuns_.fetch_sub(1); }
 
-        // Calculate input shape from buffer size and element type
-        size_t element_size = 0;
-        std::vector<int64_t> input_shape;
-
-        // Get element size based on the type
-        if (it->type == "float32")
-          element_size = sizeof(float);
-        else if (it->type == "int8" || it->type == "bool")
-          element_size = sizeof(int8_t);
-        else if (it->type == "uint8")
-          element_size = sizeof(uint8_t);
-        else if (it->type == "int16")
-          element_size = sizeof(int16_t);
-        else if (it->type == "int32")
-          element_size = sizeof(int32_t);
-        else if (it->type == "int64")
-          element_size = sizeof(int64_t);
-        else if (it->type == "float64")
-          element_size = sizeof(double);
-
-        // Attempt to infer the shape from the buffer size if we have fixed dimensions except for dynamic ones
-        int dynamic_dim_count = 0;
-        int64_t fixed_elements = 1;
-
-        for (size_t i = 0; i < it->dims.size(); i++)
-        {
-          if (it->dims[i] < 0)
-          {
-            dynamic_dim_count++;
-          }
-          else
-          {
-            fixed_elements *= static_cast<int64_t>(it->dims[i]);
-          }
-        }
+    // Runs that were already active when this one started
+    uint32_t previous() const { return previous_; }
 
-        // If there's exactly one dynamic dimension, we can infer its size
-        if (dynamic_dim_count == 1 && element_size > 0 && fixed_elements > 0)
-        {
-          size_t total_elements = byteSize / element_size;
-          int64_t dynamic_dim_size = total_elements / fixed_elements;
-
-          // Populate the input_shape with correct dimensions
-          input_shape.resize(it->dims.size());
-          int dynamic_idx = 0;
-          for (size_t i = 0; i < it->dims.size(); i++)
-          {
-            if (it->dims[i] < 0)
-            {
-              input_shape[i] = dynamic_dim_size;
-              dynamic_idx = i;
-            }
-            else
-            {
-              input_shape[i] = static_cast<int64_t>(it->dims[i]);
-            }
-          }
-        }
+  private:
+    std::atomic<uint32_t> &activeRuns_;
+    uint32_t previous_;
+  };
 
-        // Resolve any dynamic dimensions in the model
-        std::vector<int64_t> dims_int64 = resolveDynamicDimensions(it->dims, input_shape);
+  InferenceSession::PinnedFeed InferenceSession::pinFeed(const std::shared_ptr<ArrayBuffer> &buffer,
+                                                         std::vector<int64_t> dims, bool copy, bool countCopies)
+  {
+    // ArrayBuffers coming from JS can only be accessed on the JS thread. Either resolve their
+    // memory here and keep the buffer referenced for the duration of the run (zero-copy),
+    // or copy them into native memory before handing the feeds over to a worker thread.
+    std::shared_ptr<ArrayBuffer> owner = buffer;
+    if (!buffer->isOwner() && copy)
+    {
+      owner = copyArrayBuffer(buffer);
+      if (countCopies)
+        bytesCopied_ += owner->size();
+    }
+    return PinnedFeed{owner, owner->data(), owner->size(), std::move(dims)};
+  }
 
-        // Create tensor based on type
-        if (it->type == "float32")
-        {
-          inputTensors.push_back(createTensor<float>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "int8" || it->type == "bool")
-        {
-          inputTensors.push_back(createTensor<int8_t>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "uint8")
-        {
-          inputTensors.push_back(createTensor<uint8_t>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "int16")
-        {
-          inputTensors.push_back(createTensor<int16_t>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "int32")
-        {
-          inputTensors.push_back(createTensor<int32_t>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "int64")
-        {
-          inputTensors.push_back(createTensor<int64_t>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else if (it->type == "float64")
-        {
-          inputTensors.push_back(createTensor<double>(memoryInfo, data, byteSize, dims_int64));
-        }
-        else
-        {
-          throw std::runtime_error("Unsupported tensor type: " + it->type);
-        }
+  InferenceSession::PinnedFeeds InferenceSession::pinFeeds(const FeedMap &feeds, bool copy, bool countCopies)
+  {
+    PinnedFeeds pinnedFeeds;
+    pinnedFeeds.reserve(feeds.size());
+    for (const auto &[name, feed] : feeds)
+    {
+      if (std::holds_alternative<TensorFeed>(feed))
+      {
+        const TensorFeed &tensorFeed = std::get<TensorFeed>(feed);
+        pinnedFeeds.emplace(name, pinFeed(tensorFeed.data, toShape(tensorFeed.dims), copy, countCopies));
       }
-
-      // Prepare output names
-      std::vector<const char *> outputNamesC;
-      for (const auto &tensor : outputNames_)
+      else
       {
-        outputNamesC.push_back(tensor.name.c_str());
+        pinnedFeeds.emplace(name, pinFeed(std::get<std::shared_ptr<ArrayBuffer>>(feed), {}, copy, countCopies));
       }
+    }
+    attachPreprocessors(pinnedFeeds);
+    markFloat32Feeds(pinnedFeeds);
+    return pinnedFeeds;
+  }
 
-      // Run inference
-      auto outputTensors = session_->Run(Ort::RunOptions{nullptr},
-                                         inputNames.data(), inputTensors.data(), inputTensors.size(),
-                                         outputNamesC.data(), outputNamesC.size());
+  InferenceSession::PinnedFeeds InferenceSession::pinFeeds(
+      const std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> &feeds)
+  {
+    PinnedFeeds pinnedFeeds;
+    pinnedFeeds.reserve(feeds.size());
+    for (const auto &[name, buffer] : feeds)
+    {
+      pinnedFeeds.emplace(name, pinFeed(buffer, {}, !zeroCopyInputs_));
+    }
+    attachPreprocessors(pinnedFeeds);
+    markFloat32Feeds(pinnedFeeds);
+    return pinnedFeeds;
+  }
 
-      // Process output
-      std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> results;
-      for (size_t i = 0; i < outputTensors.size(); ++i)
-      {
-        auto tensorInfo = outputTensors[i].GetTensorTypeAndShapeInfo();
-        size_t elementCount = tensorInfo.GetElementCount();
-        size_t elementSize;
-        const void *outputData;
+  void InferenceSession::attachPreprocessors(PinnedFeeds &feeds)
+  {
+    std::lock_guard<std::mutex> lock(processorsMutex_);
+    if (preprocessors_.empty())
+      return;
 
-        // Get the correct data pointer and element size based on type
-        if (outputNames_[i].type == "float32")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<float>();
-          elementSize = sizeof(float);
-        }
-        else if (outputNames_[i].type == "int8" || outputNames_[i].type == "bool")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<int8_t>();
-          elementSize = sizeof(int8_t);
-        }
-        else if (outputNames_[i].type == "uint8")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<uint8_t>();
-          elementSize = sizeof(uint8_t);
-        }
-        else if (outputNames_[i].type == "int16")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<int16_t>();
-          elementSize = sizeof(int16_t);
-        }
-        else if (outputNames_[i].type == "int32")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<int32_t>();
-          elementSize = sizeof(int32_t);
-        }
-        else if (outputNames_[i].type == "int64")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<int64_t>();
-          elementSize = sizeof(int64_t);
-        }
-        else if (outputNames_[i].type == "float64")
-        {
-          outputData = outputTensors[i].GetTensorMutableData<double>();
-          elementSize = sizeof(double);
-        }
-        else
-        {
-          throw std::runtime_error("Unsupported output tensor type: " + outputNames_[i].type);
-        }
+    for (auto &[name, feed] : feeds)
+    {
+      auto preprocessor = preprocessors_.find(name);
+      if (preprocessor == preprocessors_.end())
+        continue;
+      // Explicit dims of a raw frame are its [height, width], optionally followed by bytesPerRow and uvOffset
+      if (!feed.dims.empty() && (feed.dims.size() < 2 || feed.dims.size() > 4))
+        throw std::runtime_error("Frames fed to '" + name + "' take dims [height, width, bytesPerRow?, uvOffset?]");
+      feed.preprocessor = preprocessor->second;
+    }
+  }
 
-        size_t byteSize = elementCount * elementSize;
+  void InferenceSession::markFloat32Feeds(PinnedFeeds &feeds) const
+  {
+    if (!convertHalfPrecision_)
+      return;
 
-        // Create a new owning buffer for the output data
-        uint8_t *data = new uint8_t[byteSize];
-        auto buffer = std::make_shared<margelo::nitro::NativeArrayBuffer>(
-            data,
-            byteSize,
-            [data]()
-            {
-              // This delete function will be called when the NativeArrayBuffer is destroyed
-              delete[] data;
-            });
-        std::memcpy(buffer->data(), outputData, byteSize);
+    for (auto &[name, feed] : feeds)
+    {
+      feed.float32 = isHalfPrecision(getInputPlan(name).type);
+    }
+  }
 
-        results.emplace(outputNames_[i].name, buffer);
-      }
+  Ort::Value InferenceSession::createInputTensor(const TensorPlan &plan, const PinnedFeed &feed) const
+  {
+    if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING)
+    {
+      // ONNX Runtime copies the strings into the tensor
+      auto strings = splitStrings(plan.name, feed.data, feed.byteSize);
+      auto shape = resolveShape(plan, strings.size(), feed.dims);
+      Ort::AllocatorWithDefaultOptions allocator;
+      auto tensor = Ort::Value::CreateTensor(allocator, shape.data(), shape.size(), plan.type);
+      tensor.FillStringTensor(strings.data(), strings.size());
+      return tensor;
+    }
 
-      promise->resolve(results);
+    if (feed.float32)
+    {
+      if (feed.byteSize % sizeof(float) != 0)
+        throw std::runtime_error("Buffer of '" + plan.name + "' must hold float32 values to be converted to " + getTypeString(plan.type));
+
+      size_t count = feed.byteSize / sizeof(float);
+      auto shape = resolveShape(plan, count * plan.elementSize, feed.dims);
+      Ort::AllocatorWithDefaultOptions allocator;
+      auto tensor = Ort::Value::CreateTensor(allocator, shape.data(), shape.size(), plan.type);
+      const float *values = reinterpret_cast<const float *>(feed.data);
+      uint16_t *target = static_cast<uint16_t *>(tensor.GetTensorMutableRawData());
+      if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16)
+        HalfPrecision::floatToHalf(values, target, count);
+      else
+        HalfPrecision::floatToBFloat16(values, target, count);
+      return tensor;
     }
-    catch (const Ort::Exception &e)
+
+    if (!feed.preprocessor)
     {
-      promise->reject(std::make_exception_ptr(e));
+      return createTensor(plan, memoryInfo_, feed.data, feed.byteSize, feed.dims);
     }
-    catch (const std::exception &e)
+
+    // The frame is converted straight into the tensor's memory
+    const auto &config = feed.preprocessor->config();
+    size_t height = feed.dims.empty() ? config.sourceHeight : static_cast<size_t>(feed.dims[0]);
+    size_t width = feed.dims.empty() ? config.sourceWidth : static_cast<size_t>(feed.dims[1]);
+    // The configured layout belongs to frames of the configured size, others bring their own
+    size_t bytesPerRow = feed.dims.empty() ? config.bytesPerRow : feed.dims.size() >= 3 ? static_cast<size_t>(feed.dims[2]) : 0;
+    size_t uvOffset = feed.dims.empty() ? config.uvOffset : feed.dims.size() == 4 ? static_cast<size_t>(feed.dims[3]) : 0;
+    auto shape = feed.preprocessor->outputShape();
+    Ort::AllocatorWithDefaultOptions allocator;
+    auto tensor = Ort::Value::CreateTensor(allocator, shape.data(), shape.size(), plan.type);
+    feed.preprocessor->process(feed.data, feed.byteSize, width, height, bytesPerRow, uvOffset,
+                               tensor.GetTensorMutableData<float>());
+    return tensor;
+  }
+
+  void InferenceSession::setPostprocessing(const std::string &outputName, const std::optional<Postprocessing> &options)
+  {
+    auto index = outputIndex_.find(outputName);
+    if (index == outputIndex_.end())
+    {
+      throw std::runtime_error("Output name not found: " + outputName);
+    }
+
+    std::lock_guard<std::mutex> lock(processorsMutex_);
+    auto postprocessors = postprocessors_ ? std::make_shared<PostprocessorMap>(*postprocessors_)
+                                          : std::make_shared<PostprocessorMap>();
+    if (!options.has_value())
     {
-      promise->reject(std::make_exception_ptr(e));
+      postprocessors->erase(index->second);
+    }
+    else
+    {
+      if (outputPlans_[index->second].type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT)
+        throw std::runtime_error("Output '" + outputName + "' must be float32 to be postprocessed");
+
+      Postprocessor::Config config;
+      config.kind = Postprocessor::parseKind(options->type);
+      if (options->k.has_value())
+        config.k = static_cast<size_t>(std::max(0.0, options->k.value()));
+      if (options->scoreThreshold.has_value())
+        config.scoreThreshold = static_cast<float>(options->scoreThreshold.value());
+      if (options->iouThreshold.has_value())
+        config.iouThreshold = static_cast<float>(options->iouThreshold.value());
+      if (options->maxDetections.has_value())
+        config.maxDetections = static_cast<size_t>(std::max(0.0, options->maxDetections.value()));
+      config.hasObjectness = options->hasObjectness.value_or(true);
+      config.transposed = options->transposed.value_or(false);
+      (*postprocessors)[index->second] = std::make_shared<Postprocessor>(config);
     }
 
-    return promise;
+    if (postprocessors->empty())
+      postprocessors_.reset();
+    else
+      postprocessors_ = std::move(postprocessors);
   }
 
-  void InferenceSession::dispose()
+  void InferenceSession::setImagePreprocessing(const std::string &inputName, const std::optional<ImagePreprocessing> &options)
+  {
+    const TensorPlan &plan = getInputPlan(inputName);
+    if (!options.has_value())
+    {
+      std::lock_guard<std::mutex> lock(processorsMutex_);
+      preprocessors_.erase(plan.name);
+      return;
+    }
+
+    if (plan.type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT || plan.dims.size() != 4)
+      throw std::runtime_error("Input '" + inputName + "' must be a float32 image tensor of rank 4");
+
+    ImagePreprocessor::Config config;
+    config.format = ImagePreprocessor::parseFormat(options->format);
+    config.sourceWidth = static_cast<size_t>(std::max(0.0, options->width));
+    config.sourceHeight = static_cast<size_t>(std::max(0.0, options->height));
+    config.bytesPerRow = static_cast<size_t>(std::max(0.0, options->bytesPerRow.value_or(0.0)));
+    config.uvOffset = static_cast<size_t>(std::max(0.0, options->uvOffset.value_or(0.0)));
+    if (config.uvOffset > 0 && config.format != ImagePreprocessor::PixelFormat::NV21)
+      throw std::runtime_error("uvOffset only applies to nv21 frames");
+
+    std::string layout = options->layout.value_or("nchw");
+    if (layout != "nchw" && layout != "nhwc")
+      throw std::runtime_error("Unsupported layout: " + layout);
+    config.planar = layout == "nchw";
+
+    // Positions of the channel, height and width dimensions in the model's shape
+    size_t channelDim = config.planar ? 1 : 3;
+    size_t heightDim = config.planar ? 2 : 1;
+    size_t widthDim = config.planar ? 3 : 2;
+    if (plan.dims[0] > 1 || (plan.dims[channelDim] >= 0 && plan.dims[channelDim] != 3))
+      throw std::runtime_error("Input '" + inputName + "' doesn't take a single 3-channel image in " + layout + " layout");
+
+    auto resolveTarget = [&](int64_t modelSize, const std::optional<double> &requested, const char *name)
+    {
+      if (requested.has_value())
+      {
+        if (modelSize >= 0 && static_cast<int64_t>(requested.value()) != modelSize)
+          throw std::runtime_error(std::string(name) + " doesn't match the input's size of " + std::to_string(modelSize));
+        return static_cast<size_t>(std::max(0.0, requested.value()));
+      }
+      if (modelSize < 0)
+        throw std::runtime_error(std::string(name) + " is required because the input's size is dynamic");
+      return static_cast<size_t>(modelSize);
+    };
+    config.targetWidth = resolveTarget(plan.dims[widthDim], options->targetWidth, "targetWidth");
+    config.targetHeight = resolveTarget(plan.dims[heightDim], options->targetHeight, "targetHeight");
+
+    config.bgr = options->bgr.value_or(false);
+    if (options->scale.has_value())
+      config.scale = static_cast<float>(options->scale.value());
+    auto setChannels = [](const std::optional<std::vector<double>> &values, float *target, const char *name)
+    {
+      if (!values.has_value())
+        return;
+      if (values->size() != 3)
+        throw std::runtime_error(std::string(name) + " must have 3 values");
+      for (size_t c = 0; c < 3; c++)
+        target[c] = static_cast<float>(values->at(c));
+    };
+    setChannels(options->mean, config.mean, "mean");
+    setChannels(options->std, config.std, "std");
+
+    auto preprocessor = std::make_shared<ImagePreprocessor>(config);
+    std::lock_guard<std::mutex> lock(processorsMutex_);
+    preprocessors_[plan.name] = std::move(preprocessor);
+  }
+
+  std::shared_ptr<Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>> InferenceSession::run(
+      const FeedMap &feeds, const std::optional<RunOptions> &options)
   {
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    PinnedFeeds pinnedFeeds;
+    std::shared_ptr<RunContext> context;
     try
     {
+      pinnedFeeds = pinFeeds(feeds, !zeroCopyInputs_);
+      std::shared_ptr<const PostprocessorMap> postprocessors;
+      {
+        std::lock_guard<std::mutex> lock(processorsMutex_);
+        postprocessors = postprocessors_;
+      }
+      // Runs with their own options or postprocessed outputs can't share a batched run
+      if (options.has_value() || postprocessors)
+      {
+        context = createRunContext(options);
+        context->postprocessors = std::move(postprocessors);
+      }
+    }
+    catch (...)
+    {
+      auto promise = Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>::create();
+      promise->reject(std::current_exception());
+      return promise;
+    }
+
+    {
+      std::unique_lock<std::mutex> lock(batchMutex_);
+      bool hasFrames = std::any_of(pinnedFeeds.begin(), pinnedFeeds.end(), [](const auto &feed)
+                                   { return feed.second.preprocessor != nullptr; });
+      if (maxBatchSize_ > 0 && workerPool_ && !context && !stateful_ && !hasFrames)
+      {
+        auto promise = Promise<BufferMap>::create();
+        pendingRuns_.push_back(PendingRun{std::move(pinnedFeeds), promise});
+        if (batchScheduled_)
+        {
+          batchCondition_.notify_one();
+          return promise;
+        }
+
+        batchScheduled_ = true;
+        lock.unlock();
+        try
+        {
+          workerPool_->submit([self]()
+                              { self->collectBatch(); });
+        }
+        catch (...)
+        {
+          lock.lock();
+          batchScheduled_ = false;
+          pendingRuns_.pop_back();
+          promise->reject(std::current_exception());
+        }
+        return promise;
+      }
+    }
+
+    if (!context)
+      context = createRunContext(std::nullopt);
+    return dispatch<BufferMap>(
+        [self, pinnedFeeds = std::move(pinnedFeeds), context]()
+        {
+          return self->runInternal(pinnedFeeds, context.get());
+        });
+  }
+
+  std::optional<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>> InferenceSession::runSync(
+      const FeedMap &feeds, const std::optional<RunOptions> &options, const std::optional<bool> &dropIfBusy)
+  {
+    // Counted before checking, so that of two frames arriving at once only one runs
+    ActiveRunScope activeRun(activeRuns_);
+    if (activeRun.previous() > 0 && dropIfBusy.value_or(true))
+    {
+      droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+    // Reloading takes as long as loading did, so it happens on a worker thread rather than in the
+    // frame processor. Frames are dropped until the session is back. Running sessions aren't
+    // evicted, so it can't be evicted past this point.
+    if (isEvicted())
+    {
+      reloadInBackground();
+      if (!dropIfBusy.value_or(true))
+        throw std::runtime_error("Session was evicted and is reloading on a worker thread, call runSync() again once it has loaded");
+      droppedFrames_.fetch_add(1, std::memory_order_relaxed);
+      return std::nullopt;
+    }
+
+    // The run finishes before this call returns, so feeds are always used in place. Frame
+    // buffers can only be read on the calling thread, which is the one running inference here.
+    PinnedFeeds pinnedFeeds = pinFeeds(feeds, false);
+    auto context = createRunContext(options);
+    {
+      std::lock_guard<std::mutex> lock(processorsMutex_);
+      context->postprocessors = postprocessors_;
+    }
+    return runInternal(pinnedFeeds, context.get());
+  }
+
+  std::shared_ptr<Promise<std::vector<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>>> InferenceSession::runBatch(
+      const std::vector<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>> &feeds)
+  {
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    std::vector<PinnedFeeds> requests;
+    try
+    {
+      requests.reserve(feeds.size());
+      for (const auto &request : feeds)
+      {
+        requests.push_back(pinFeeds(request));
+      }
+    }
+    catch (...)
+    {
+      auto promise = Promise<std::vector<BufferMap>>::create();
+      promise->reject(std::current_exception());
+      return promise;
+    }
+
+    auto context = createRunContext(std::nullopt);
+    return dispatch<std::vector<BufferMap>>(
+        [self, requests = std::move(requests), context]()
+        {
+          return self->runBatchInternal(requests, context.get());
+        });
+  }
+
+  void InferenceSession::setAutoBatching(const std::optional<AutoBatchingOptions> &options)
+  {
+    if (options.has_value())
+    {
+      if (options->maxBatchSize < 1)
+        throw std::runtime_error("maxBatchSize must be at least 1");
+      if (options->maxWaitMicros < 0)
+        throw std::runtime_error("maxWaitMicros must not be negative");
+
+      // Fail early instead of on the first batched run
+      for (const auto &input : inputPlans_)
+        getBatchEntrySize(input);
+      for (const auto &output : outputPlans_)
+        getBatchEntrySize(output);
+    }
+
+    std::lock_guard<std::mutex> lock(batchMutex_);
+    maxBatchSize_ = options.has_value() ? static_cast<size_t>(options->maxBatchSize) : 0;
+    maxBatchWait_ = std::chrono::microseconds(options.has_value() ? static_cast<int64_t>(options->maxWaitMicros) : 0);
+    batchCondition_.notify_one();
+  }
+
+  void InferenceSession::collectBatch()
+  {
+    // Keeps collecting on this worker until no run() calls are left waiting
+    while (true)
+    {
+      std::vector<PendingRun> batch;
+      {
+        std::unique_lock<std::mutex> lock(batchMutex_);
+        // Don't hold the worker waiting for runs that may never come
+        if (pendingRuns_.empty())
+        {
+          batchScheduled_ = false;
+          return;
+        }
+        auto deadline = std::chrono::steady_clock::now() + maxBatchWait_;
+        batchCondition_.wait_until(lock, deadline, [this]()
+                                   { return pendingRuns_.size() >= std::max<size_t>(maxBatchSize_, 1); });
+
+        size_t count = maxBatchSize_ > 0 ? std::min(pendingRuns_.size(), maxBatchSize_) : pendingRuns_.size();
+        batch.insert(batch.end(), std::make_move_iterator(pendingRuns_.begin()),
+                     std::make_move_iterator(pendingRuns_.begin() + count));
+        pendingRuns_.erase(pendingRuns_.begin(), pendingRuns_.begin() + count);
+      }
+
+      try
+      {
+        std::vector<PinnedFeeds> requests;
+        requests.reserve(batch.size());
+        for (auto &pending : batch)
+        {
+          requests.push_back(std::move(pending.feeds));
+        }
+
+        auto context = createRunContext(std::nullopt);
+        auto results = runBatchInternal(requests, context.get());
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+          batch[i].promise->resolve(results[i]);
+        }
+      }
+      catch (...)
+      {
+        for (auto &pending : batch)
+        {
+          pending.promise->reject(std::current_exception());
+        }
+      }
+    }
+  }
+
+  std::vector<InferenceSession::BufferMap> InferenceSession::runBatchInternal(const std::vector<PinnedFeeds> &requests,
+                                                                             RunContext *context)
+  {
+    if (requests.empty())
+    {
+      return {};
+    }
+    if (requests.size() == 1)
+    {
+      return {runInternal(requests[0], context)};
+    }
+    // Every request would need its own state
+    if (stateful_)
+    {
+      throw std::runtime_error("Batched runs are not supported while state is enabled");
+    }
+    ActiveRunScope activeRun(activeRuns_);
+
+    // Outputs are sliced along their first dimension, which therefore has to be the batch
+    for (const auto &output : outputPlans_)
+    {
+      getBatchEntrySize(output);
+    }
+
+    // Number of batch entries each request contributes, derived from its feed sizes
+    std::vector<size_t> batchSizes(requests.size(), 0);
+    size_t totalBatchSize = 0;
+    PinnedFeeds stacked;
+
+    for (const auto &[name, firstFeed] : requests[0])
+    {
+      const TensorPlan &plan = getInputPlan(name);
+      size_t entrySize = getBatchEntrySize(plan);
+      // Converted feeds hold float32 values in place of the model's 16-bit ones
+      if (firstFeed.float32)
+        entrySize = entrySize / plan.elementSize * sizeof(float);
+
+      size_t totalBytes = 0;
+      for (size_t r = 0; r < requests.size(); r++)
+      {
+        auto feed = requests[r].find(name);
+        if (feed == requests[r].end())
+        {
+          throw std::runtime_error("Batch request " + std::to_string(r) + " is missing input: " + name);
+        }
+        if (feed->second.preprocessor)
+        {
+          throw std::runtime_error("Input '" + name + "' takes raw frames, which can't be batched");
+        }
+        if (feed->second.float32 != firstFeed.float32)
+        {
+          throw std::runtime_error("Input '" + name + "' of batch request " + std::to_string(r) +
+                                   " was pinned with a different convertHalfPrecision setting");
+        }
+        if (feed->second.byteSize % entrySize != 0)
+        {
+          throw std::runtime_error("Input '" + name + "' of batch request " + std::to_string(r) +
+                                   " is not a whole number of batch entries");
+        }
+        size_t entries = feed->second.byteSize / entrySize;
+        if (batchSizes[r] == 0)
+        {
+          batchSizes[r] = entries;
+        }
+        else if (batchSizes[r] != entries)
+        {
+          throw std::runtime_error("Inputs of batch request " + std::to_string(r) + " have different batch sizes");
+        }
+        totalBytes += feed->second.byteSize;
+      }
+
+      auto buffer = allocateArrayBuffer(totalBytes);
+      size_t offset = 0;
+      for (const auto &request : requests)
+      {
+        const auto &feed = request.at(name);
+        std::memcpy(buffer->data() + offset, feed.data, feed.byteSize);
+        offset += feed.byteSize;
+      }
+      bytesCopied_ += totalBytes;
+      PinnedFeed stackedFeed{buffer, buffer->data(), totalBytes, {}};
+      stackedFeed.float32 = firstFeed.float32;
+      stacked.emplace(name, std::move(stackedFeed));
+    }
+
+    for (size_t r = 0; r < requests.size(); r++)
+    {
+      if (requests[r].size() != requests[0].size())
+      {
+        throw std::runtime_error("Batch request " + std::to_string(r) + " has a different set of inputs");
+      }
+      totalBatchSize += batchSizes[r];
+    }
+
+    BufferMap outputs = runInternal(stacked, context);
+
+    // Slice every output back into per-request views over the batched result
+    std::vector<BufferMap> results(requests.size());
+    for (const auto &[name, output] : outputs)
+    {
+      if (output->size() % totalBatchSize != 0)
+      {
+        throw std::runtime_error("Output '" + name + "' can't be split along the batch dimension");
+      }
+      size_t entrySize = output->size() / totalBatchSize;
+
+      size_t offset = 0;
+      for (size_t r = 0; r < requests.size(); r++)
+      {
+        size_t byteSize = batchSizes[r] * entrySize;
+        auto slice = std::make_shared<margelo::nitro::NativeArrayBuffer>(
+            output->data() + offset,
+            byteSize,
+            [output]()
+            {
+              // Keeps the batched output alive for as long as any of its slices is
+            });
+        results[r].emplace(name, slice);
+        offset += byteSize;
+      }
+    }
+
+    return results;
+  }
+
+  void InferenceSession::bindOutputs(const FeedMap &outputs)
+  {
+    // Bound outputs are written from a worker thread, so they are always pinned rather than copied
+    PinnedFeeds pinnedOutputs;
+    pinnedOutputs.reserve(outputs.size());
+    for (const auto &[name, output] : outputs)
+    {
+      if (std::holds_alternative<TensorFeed>(output))
+      {
+        const TensorFeed &tensorFeed = std::get<TensorFeed>(output);
+        pinnedOutputs.emplace(name, pinFeed(tensorFeed.data, toShape(tensorFeed.dims), false));
+      }
+      else
+      {
+        pinnedOutputs.emplace(name, pinFeed(std::get<std::shared_ptr<ArrayBuffer>>(output), {}, false));
+      }
+    }
+
+    // Checked here so that mistakes surface on this call, the binding itself is made by runBound()
+    for (const auto &[name, output] : pinnedOutputs)
+    {
+      const TensorPlan &plan = getOutputPlan(name);
+      if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING)
+        throw std::runtime_error("String output '" + name + "' can't be bound to a buffer");
+      resolveShape(plan, output.byteSize, output.dims);
+    }
+
+    std::lock_guard<std::mutex> bindingLock(bindingMutex_);
+    ioBinding_.reset();
+    boundOutputs_ = std::move(pinnedOutputs);
+  }
+
+  void InferenceSession::clearBoundOutputs()
+  {
+    std::lock_guard<std::mutex> bindingLock(bindingMutex_);
+    ioBinding_.reset();
+    boundOutputs_.clear();
+  }
+
+  std::shared_ptr<Promise<void>> InferenceSession::runBound(const FeedMap &feeds, const std::optional<RunOptions> &options)
+  {
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    PinnedFeeds pinnedFeeds;
+    std::shared_ptr<RunContext> context;
+    try
+    {
+      if (options.has_value() && options->outputNames.has_value())
+        throw std::runtime_error("runBound() computes the bound outputs, select them through bindOutputs()");
+      pinnedFeeds = pinFeeds(feeds, !zeroCopyInputs_);
+      context = createRunContext(options);
+    }
+    catch (...)
+    {
+      auto promise = Promise<void>::create();
+      promise->reject(std::current_exception());
+      return promise;
+    }
+
+    return dispatch<void>(
+        [self, pinnedFeeds = std::move(pinnedFeeds), context]()
+        {
+          self->runBoundInternal(pinnedFeeds, context.get());
+        });
+  }
+
+  void InferenceSession::runBoundInternal(const PinnedFeeds &feeds, RunContext *context)
+  {
+    std::lock_guard<std::mutex> bindingLock(bindingMutex_);
+    auto lock = lockSession();
+    if (context && context->terminated)
+    {
+      throw std::runtime_error("Run was terminated");
+    }
+    if (boundOutputs_.empty())
+    {
+      throw std::runtime_error("No outputs are bound, call bindOutputs() before runBound()");
+    }
+    ActiveRunScope activeRun(activeRuns_);
+    if (stateful_)
+    {
+      throw std::runtime_error("runBound() is not supported while state is enabled");
+    }
+    if (!ioBinding_)
+    {
+      auto ioBinding = std::make_unique<Ort::IoBinding>(*session_);
+      for (const auto &[name, output] : boundOutputs_)
+      {
+        ioBinding->BindOutput(name.c_str(), createTensor(getOutputPlan(name), memoryInfo_, output.data, output.byteSize, output.dims));
+      }
+      ioBinding_ = std::move(ioBinding);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t bytesIn = 0;
+    try
+    {
+      for (const auto &[name, feed] : feeds)
+      {
+        bytesIn += feed.byteSize;
+        ioBinding_->BindInput(name.c_str(), createInputTensor(getInputPlan(name), feed));
+      }
+
+      RunOptionsScope runOptions(*this, context);
+      session_->Run(runOptions.get(), *ioBinding_);
+      ioBinding_->SynchronizeOutputs();
+    }
+    catch (...)
+    {
+      ioBinding_->ClearBoundInputs();
+      throw;
+    }
+
+    // The inputs reference the pinned feeds, which are released once this run returns
+    ioBinding_->ClearBoundInputs();
+
+    size_t bytesOut = 0;
+    for (const auto &[name, output] : boundOutputs_)
+    {
+      bytesOut += output.byteSize;
+    }
+    recordRun(std::chrono::steady_clock::now() - start, bytesIn, bytesOut);
+  }
+
+  std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> InferenceSession::runInternal(const PinnedFeeds &feeds,
+                                                                                                RunContext *context)
+  {
+    auto lock = lockSession();
+    // Terminated while queued, terminating later is picked up by ONNX Runtime through the run options
+    if (context && context->terminated)
+    {
+      throw std::runtime_error("Run was terminated");
+    }
+    ActiveRunScope activeRun(activeRuns_);
+    // A run in between two generation steps would advance the generated sequence
+    if (stateful_ && generations_ > 0)
+    {
+      throw std::runtime_error("generate() is using the session's state, run once it has finished");
+    }
+
+    // Stateless runs don't hold the state lock and can run concurrently
+    std::unique_lock<std::mutex> stateLock(stateMutex_);
+    std::vector<StateSlot> noState;
+    std::vector<StateSlot> &stateSlots = stateSlots_.empty() ? noState : stateSlots_;
+    if (stateSlots.empty())
+    {
+      stateLock.unlock();
+    }
+    return runLocked(feeds, context, nullptr, stateSlots);
+  }
+
+  InferenceSession::BufferMap InferenceSession::runLocked(const PinnedFeeds &feeds, RunContext *context,
+                                                          RunTimings *timings, std::vector<StateSlot> &stateSlots)
+  {
+    auto start = std::chrono::steady_clock::now();
+    bool convertHalfPrecision = convertHalfPrecision_;
+
+    // Prepare inputs
+    std::vector<const char *> inputNames;
+    std::vector<Ort::Value> inputTensors;
+    inputNames.reserve(feeds.size() + stateSlots.size());
+    inputTensors.reserve(feeds.size() + stateSlots.size());
+    size_t bytesIn = 0;
+    for (const auto &[name, feed] : feeds)
+    {
+      const TensorPlan &plan = getInputPlan(name);
+      bytesIn += feed.byteSize;
+      inputNames.push_back(plan.name.c_str());
+      inputTensors.push_back(createInputTensor(plan, feed));
+    }
+
+    // Carry the previous run's state over unless the caller fed it explicitly
+    std::vector<std::pair<StateSlot *, size_t>> carried;
+    std::vector<FedShape> fedShapes;
+    for (auto &slot : stateSlots)
+    {
+      const TensorPlan &plan = inputPlans_[slot.input];
+      if (feeds.count(plan.name) > 0)
+        continue;
+      if (slot.value != nullptr)
+      {
+        carried.emplace_back(&slot, inputTensors.size());
+        inputNames.push_back(plan.name.c_str());
+        inputTensors.push_back(std::move(slot.value));
+        continue;
+      }
+
+      // A new sequence, its state takes the batch size of this run's feeds
+      if (slot.initialShape.empty() && fedShapes.empty())
+      {
+        for (size_t i = 0; i < feeds.size(); i++)
+        {
+          const TensorPlan &fed = getInputPlan(inputNames[i]);
+          fedShapes.push_back(FedShape{fed.dims, fed.symbolicDims, inputTensors[i].GetTensorTypeAndShapeInfo().GetShape()});
+        }
+      }
+      inputNames.push_back(plan.name.c_str());
+      inputTensors.push_back(createInitialState(plan, slot.initialShape.empty()
+                                                          ? initialStateShape(plan.dims, plan.symbolicDims, fedShapes)
+                                                          : slot.initialShape));
+    }
+
+    auto tensorsCreated = std::chrono::steady_clock::now();
+
+    // Only the requested outputs are fetched, ONNX Runtime skips nodes that nothing else needs
+    const std::vector<size_t> *fetchedOutputs = nullptr; // All outputs in order
+    const std::vector<const char *> *fetchedNames = &outputNamesC_;
+    std::vector<size_t> selectedOutputs;
+    std::vector<const char *> selectedNames;
+    if (context && !context->outputs.empty())
+    {
+      selectedOutputs = context->outputs;
+      // State outputs are always fetched, the next run needs them
+      for (const auto &slot : stateSlots)
+      {
+        if (std::find(selectedOutputs.begin(), selectedOutputs.end(), slot.output) == selectedOutputs.end())
+          selectedOutputs.push_back(slot.output);
+      }
+      for (size_t index : selectedOutputs)
+      {
+        selectedNames.push_back(outputPlans_[index].name.c_str());
+      }
+      fetchedOutputs = &selectedOutputs;
+      fetchedNames = &selectedNames;
+    }
+
+    // Run inference
+    RunOptionsScope runOptions(*this, context);
+    std::vector<Ort::Value> outputTensors;
+    try
+    {
+      outputTensors = session_->Run(runOptions.get(),
+                                    inputNames.data(), inputTensors.data(), inputTensors.size(),
+                                    fetchedNames->data(), fetchedNames->size());
+    }
+    catch (...)
+    {
+      // Keep the state of the last successful run
+      for (auto &[slot, index] : carried)
+      {
+        slot->value = std::move(inputTensors[index]);
+      }
+      throw;
+    }
+
+    auto ran = std::chrono::steady_clock::now();
+
+    // Process output
+    std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> results;
+    results.reserve(outputTensors.size());
+    size_t bytesOut = 0;
+    for (size_t i = 0; i < outputTensors.size(); ++i)
+    {
+      size_t index = fetchedOutputs ? (*fetchedOutputs)[i] : i;
+
+      // State stays native for the next run instead of being handed to JS
+      auto slot = std::find_if(stateSlots.begin(), stateSlots.end(), [index](const StateSlot &stateSlot)
+                               { return stateSlot.output == index; });
+      if (slot != stateSlots.end())
+      {
+        slot->value = std::move(outputTensors[i]);
+        continue;
+      }
+
+      const TensorPlan &plan = outputPlans_[index];
+      auto shapeInfo = outputTensors[i].GetTensorTypeAndShapeInfo();
+      size_t count = shapeInfo.GetElementCount();
+      std::shared_ptr<ArrayBuffer> buffer;
+      if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING)
+      {
+        buffer = joinStrings(outputTensors[i]);
+        bytesOut += buffer->size();
+      }
+      else if (convertHalfPrecision && isHalfPrecision(plan.type))
+      {
+        bytesOut += count * plan.elementSize;
+        buffer = allocateArrayBuffer(count * sizeof(float));
+        const uint16_t *values = static_cast<const uint16_t *>(outputTensors[i].GetTensorRawData());
+        float *target = reinterpret_cast<float *>(buffer->data());
+        if (plan.type == ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT16)
+          HalfPrecision::halfToFloat(values, target, count);
+        else
+          HalfPrecision::bfloat16ToFloat(values, target, count);
+      }
+      else
+      {
+        size_t byteSize = count * plan.elementSize;
+        bytesOut += byteSize;
+        void *outputData = outputTensors[i].GetTensorMutableRawData();
+
+        // Hand the tensor memory to JS without copying it. The buffer takes ownership of the
+        // Ort::Value and releases it once the ArrayBuffer is garbage collected.
+        Ort::Value *value = new Ort::Value(std::move(outputTensors[i]));
+        buffer = std::make_shared<margelo::nitro::NativeArrayBuffer>(
+            static_cast<uint8_t *>(outputData),
+            byteSize,
+            [value]()
+            {
+              delete value;
+            });
+      }
+
+      if (context && context->postprocessors)
+      {
+        auto postprocessor = context->postprocessors->find(index);
+        if (postprocessor != context->postprocessors->end())
+        {
+          auto result = postprocessor->second->process(reinterpret_cast<float *>(buffer->data()),
+                                                       buffer->size() / sizeof(float), shapeInfo.GetShape());
+          // Without a result the output was processed in place and keeps its buffer
+          if (result)
+            buffer = wrapArrayBuffer(std::move(*result));
+        }
+      }
+
+      results.emplace(plan.name, buffer);
+    }
+
+    auto finished = std::chrono::steady_clock::now();
+    if (timings)
+    {
+      timings->tensorCreation = tensorsCreated - start;
+      timings->run = ran - tensorsCreated;
+      timings->outputs = finished - ran;
+    }
+    else
+    {
+      recordRun(finished - start, bytesIn, bytesOut);
+    }
+    return results;
+  }
+
+
+  std::shared_ptr<Promise<BenchmarkResult>> InferenceSession::benchmark(const BenchmarkOptions &options)
+  {
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    PinnedFeeds pinnedFeeds;
+    size_t warmup = 5;
+    size_t iterations = 50;
+    try
+    {
+      if (options.warmup.has_value())
+      {
+        if (options.warmup.value() < 0)
+          throw std::runtime_error("warmup must not be negative");
+        warmup = static_cast<size_t>(options.warmup.value());
+      }
+      if (options.iterations.has_value())
+      {
+        if (options.iterations.value() < 1)
+          throw std::runtime_error("iterations must be at least 1");
+        iterations = static_cast<size_t>(options.iterations.value());
+      }
+      pinnedFeeds = pinFeeds(options.feeds, !zeroCopyInputs_, false);
+    }
+    catch (...)
+    {
+      auto promise = Promise<BenchmarkResult>::create();
+      promise->reject(std::current_exception());
+      return promise;
+    }
+
+    return dispatch<BenchmarkResult>(
+        [self, pinnedFeeds = std::move(pinnedFeeds), warmup, iterations]()
+        {
+          return self->benchmarkInternal(pinnedFeeds, warmup, iterations);
+        });
+  }
+
+  BenchmarkResult InferenceSession::benchmarkInternal(const PinnedFeeds &feeds, size_t warmup, size_t iterations)
+  {
+    using Milliseconds = std::chrono::duration<double, std::milli>;
+
+    auto lock = lockSession();
+    ActiveRunScope activeRun(activeRuns_);
+
+    // Every iteration starts a new sequence in slots of its own, the session's carried state stays as it is
+    std::vector<StateSlot> stateSlots;
+    {
+      std::lock_guard<std::mutex> stateLock(stateMutex_);
+      for (const auto &slot : stateSlots_)
+      {
+        stateSlots.push_back(StateSlot{slot.output, slot.input, slot.initialShape});
+      }
+    }
+    auto runOnce = [&](RunTimings &timings)
+    {
+      for (auto &slot : stateSlots)
+      {
+        slot.value = Ort::Value{nullptr};
+      }
+      runLocked(feeds, nullptr, &timings, stateSlots);
+    };
+
+    for (size_t i = 0; i < warmup; i++)
+    {
+      RunTimings timings;
+      runOnce(timings);
+    }
+
+    // Goes through the same path as run(), minus the JS thread hops
+    std::vector<double> latencies;
+    latencies.reserve(iterations);
+    RunTimings totals;
+    for (size_t i = 0; i < iterations; i++)
+    {
+      RunTimings timings;
+      auto start = std::chrono::steady_clock::now();
+      runOnce(timings);
+      latencies.push_back(Milliseconds(std::chrono::steady_clock::now() - start).count());
+
+      totals.tensorCreation += timings.tensorCreation;
+      totals.run += timings.run;
+      totals.outputs += timings.outputs;
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    // Nearest-rank percentile
+    auto percentile = [&latencies](double p)
+    {
+      size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * latencies.size()));
+      return latencies[std::max<size_t>(rank, 1) - 1];
+    };
+
+    double count = static_cast<double>(iterations);
+    double totalMs = 0;
+    for (double latency : latencies)
+    {
+      totalMs += latency;
+    }
+
+    BenchmarkResult result;
+    result.iterations = count;
+    result.meanMs = totalMs / count;
+    result.p50Ms = percentile(50);
+    result.p90Ms = percentile(90);
+    result.p99Ms = percentile(99);
+    result.minMs = latencies.front();
+    result.maxMs = latencies.back();
+    result.throughput = totalMs > 0 ? count / (totalMs / 1000.0) : 0;
+    result.tensorCreationMs = Milliseconds(totals.tensorCreation).count() / count;
+    result.runMs = Milliseconds(totals.run).count() / count;
+    result.outputMs = Milliseconds(totals.outputs).count() / count;
+    return result;
+  }
+
+  void InferenceSession::enableState(const std::unordered_map<std::string, std::string> &outputToInput,
+                                     const std::optional<std::unordered_map<std::string, std::vector<double>>> &initialShapes)
+  {
+    if (outputToInput.empty())
+    {
+      throw std::runtime_error("enableState() needs at least one output to carry over");
+    }
+
+    std::vector<StateSlot> slots;
+    slots.reserve(outputToInput.size());
+    for (const auto &[outputName, inputName] : outputToInput)
+    {
+      auto output = outputIndex_.find(outputName);
+      if (output == outputIndex_.end())
+        throw std::runtime_error("Output name not found: " + outputName);
+      auto input = inputIndex_.find(inputName);
+      if (input == inputIndex_.end())
+        throw std::runtime_error("Input name not found: " + inputName);
+      if (outputPlans_[output->second].type != inputPlans_[input->second].type)
+        throw std::runtime_error("Output '" + outputName + "' and input '" + inputName + "' have different types");
+      if (inputPlans_[input->second].type == ONNX_TENSOR_ELEMENT_DATA_TYPE_STRING)
+        throw std::runtime_error("String tensors can't be carried as state");
+      slots.push_back(StateSlot{output->second, input->second});
+    }
+
+    for (const auto &[inputName, dims] : initialShapes.value_or(std::unordered_map<std::string, std::vector<double>>{}))
+    {
+      auto slot = std::find_if(slots.begin(), slots.end(), [&](const StateSlot &stateSlot)
+                               { return inputPlans_[stateSlot.input].name == inputName; });
+      if (slot == slots.end())
+        throw std::runtime_error("'" + inputName + "' is not a state input, it has no initial shape");
+      const TensorPlan &plan = inputPlans_[slot->input];
+      std::vector<int64_t> shape = toShape(dims);
+      if (shape.size() != plan.dims.size())
+        throw std::runtime_error("Initial shape of '" + inputName + "' needs " + std::to_string(plan.dims.size()) + " dimensions");
+      for (size_t i = 0; i < shape.size(); i++)
+      {
+        if (plan.dims[i] >= 0 && plan.dims[i] != shape[i])
+          throw std::runtime_error("Dimension " + std::to_string(i) + " of '" + inputName + "' is fixed to " + std::to_string(plan.dims[i]));
+      }
+      slot->initialShape = std::move(shape);
+    }
+
+    rejectWhileGenerating();
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    stateSlots_ = std::move(slots);
+    stateful_ = true;
+  }
+
+  void InferenceSession::rejectWhileGenerating() const
+  {
+    // Called on the JS thread, which must not wait for a whole generation
+    if (generations_ > 0)
+      throw std::runtime_error("The state can't be changed while generate() is running");
+  }
+
+  void InferenceSession::disableState()
+  {
+    rejectWhileGenerating();
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    stateSlots_.clear();
+    stateful_ = false;
+  }
+
+  void InferenceSession::resetState()
+  {
+    rejectWhileGenerating();
+    std::lock_guard<std::mutex> lock(stateMutex_);
+    for (auto &slot : stateSlots_)
+    {
+      slot.value = Ort::Value{nullptr};
+    }
+  }
+
+  std::shared_ptr<Promise<std::vector<double>>> InferenceSession::generate(
+      const GenerateOptions &options, const std::optional<std::function<void(double)>> &onToken)
+  {
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    std::shared_ptr<RunContext> context;
+    try
+    {
+      if (options.promptTokens.empty())
+        throw std::runtime_error("promptTokens must not be empty");
+      if (options.maxNewTokens < 1)
+        throw std::runtime_error("maxNewTokens must be at least 1");
+
+      auto requireIntegerInput = [](const TensorPlan &plan)
+      {
+        if (plan.type != ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64 && plan.type != ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32)
+          throw std::runtime_error("Input '" + plan.name + "' must be int64 or int32");
+      };
+      requireIntegerInput(getInputPlan(options.inputIdsName.value_or("input_ids")));
+      // Named inputs must exist, the default names are only fed to models that have them
+      for (const auto &[name, fallback] : {std::pair{options.attentionMaskName, "attention_mask"},
+                                           std::pair{options.positionIdsName, "position_ids"}})
+      {
+        if (name.has_value() || inputIndex_.count(fallback) > 0)
+          requireIntegerInput(getInputPlan(name.value_or(fallback)));
+      }
+      const TensorPlan &logits = getOutputPlan(options.logitsName.value_or("logits"));
+      if (logits.type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT || logits.dims.empty() || logits.dims.back() <= 0)
+        throw std::runtime_error("Output '" + logits.name + "' must be float32 with a fixed vocabulary dimension");
+
+      // Only the logits (and any carried state) are fetched per step
+      RunOptions runOptions;
+      runOptions.tag = options.tag;
+      runOptions.outputNames = std::vector<std::string>{logits.name};
+      context = createRunContext(runOptions);
+      context->generation = true;
+    }
+    catch (...)
+    {
+      auto promise = Promise<std::vector<double>>::create();
+      promise->reject(std::current_exception());
+      return promise;
+    }
+
+    std::function<void(double)> callback = onToken.value_or(nullptr);
+    return dispatch<std::vector<double>>(
+        [self, options, callback, context]()
+        {
+          return self->generateInternal(options, callback, context.get());
+        });
+  }
+
+  std::vector<double> InferenceSession::generateInternal(const GenerateOptions &options,
+                                                         const std::function<void(double)> &onToken,
+                                                         RunContext *context)
+  {
+    std::string inputIdsName = options.inputIdsName.value_or("input_ids");
+    std::string logitsName = options.logitsName.value_or("logits");
+    std::string attentionMaskName = options.attentionMaskName.value_or("attention_mask");
+    std::string positionIdsName = options.positionIdsName.value_or("position_ids");
+    bool hasAttentionMask = inputIndex_.count(attentionMaskName) > 0;
+    bool hasPositionIds = inputIndex_.count(positionIdsName) > 0;
+
+    SamplingParams params;
+    params.temperature = static_cast<float>(options.temperature.value_or(1.0));
+    params.topK = static_cast<size_t>(std::max(0.0, options.topK.value_or(0.0)));
+    params.topP = static_cast<float>(options.topP.value_or(1.0));
+    params.repetitionPenalty = static_cast<float>(options.repetitionPenalty.value_or(1.0));
+    uint64_t seed = options.seed.has_value() ? static_cast<uint64_t>(options.seed.value()) : std::random_device{}();
+    Sampler sampler(params, seed);
+
+    std::vector<int64_t> stopTokens;
+    for (double token : options.stopTokens.value_or(std::vector<double>{}))
+    {
+      stopTokens.push_back(static_cast<int64_t>(token));
+    }
+
+    std::vector<int64_t> tokens;
+    tokens.reserve(options.promptTokens.size() + static_cast<size_t>(options.maxNewTokens));
+    for (double token : options.promptTokens)
+    {
+      tokens.push_back(static_cast<int64_t>(token));
+    }
+
+    // [1, count] feed of the input's integer type (checked by generate()), element i set to value(i)
+    auto makeFeed = [this](const std::string &name, size_t count, const auto &value)
+    {
+      const TensorPlan &plan = getInputPlan(name);
+      auto buffer = allocateArrayBuffer(count * plan.elementSize);
+      switch (plan.type)
+      {
+      case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT32:
+        for (size_t i = 0; i < count; i++)
+          reinterpret_cast<int32_t *>(buffer->data())[i] = static_cast<int32_t>(value(i));
+        break;
+      case ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64:
+        for (size_t i = 0; i < count; i++)
+          reinterpret_cast<int64_t *>(buffer->data())[i] = value(i);
+        break;
+      default:
+        throw std::runtime_error("Input '" + name + "' must be int64 or int32");
+      }
+      return PinnedFeed{buffer, buffer->data(), buffer->size(), {1, static_cast<int64_t>(count)}};
+    };
+
+    // The session and its state are held for the whole generation, so that no other run can
+    // advance or reset the sequence between two steps
+    auto lock = lockSession();
+    ActiveRunScope activeRun(activeRuns_);
+    ActiveRunScope generation(generations_);
+    std::unique_lock<std::mutex> stateLock(stateMutex_);
+    std::vector<StateSlot> noState;
+    std::vector<StateSlot> &stateSlots = stateSlots_.empty() ? noState : stateSlots_;
+    bool stateful = !stateSlots.empty();
+    if (!stateful)
+      stateLock.unlock();
+
+    // A generation is a new sequence, the first step sizes the state from its feeds
+    for (auto &slot : stateSlots)
+    {
+      slot.value = Ort::Value{nullptr};
+    }
+
+    std::vector<double> generated;
+    size_t maxNewTokens = static_cast<size_t>(options.maxNewTokens);
+    for (size_t step = 0; step < maxNewTokens; step++)
+    {
+      if (context->terminated)
+      {
+        throw std::runtime_error("Run was terminated");
+      }
+
+      // With the past carried natively only the newest token is fed after the prompt
+      size_t past = stateful && step > 0 ? tokens.size() - 1 : 0;
+      size_t count = tokens.size() - past;
+
+      PinnedFeeds feeds;
+      feeds.emplace(inputIdsName, makeFeed(inputIdsName, count, [&](size_t i)
+                                           { return tokens[past + i]; }));
+      if (hasAttentionMask)
+        feeds.emplace(attentionMaskName, makeFeed(attentionMaskName, tokens.size(), [](size_t)
+                                                  { return int64_t{1}; }));
+      if (hasPositionIds)
+        feeds.emplace(positionIdsName, makeFeed(positionIdsName, count, [&](size_t i)
+                                                { return static_cast<int64_t>(past + i); }));
+
+      auto outputs = runLocked(feeds, context, nullptr, stateSlots);
+      const auto &logits = outputs.at(logitsName);
+
+      // Sample from the logits of the last position
+      size_t vocabSize = static_cast<size_t>(getOutputPlan(logitsName).dims.back());
+      size_t positions = logits->size() / sizeof(float) / vocabSize;
+      if (positions == 0)
+        throw std::runtime_error("Output '" + logitsName + "' is empty");
+      const float *lastLogits = reinterpret_cast<const float *>(logits->data()) + (positions - 1) * vocabSize;
+      int64_t token = sampler.sample(lastLogits, vocabSize, tokens);
+
+      tokens.push_back(token);
+      generated.push_back(static_cast<double>(token));
+      if (onToken)
+        onToken(static_cast<double>(token));
+
+      if (std::find(stopTokens.begin(), stopTokens.end(), token) != stopTokens.end())
+        break;
+    }
+    return generated;
+  }
+
+  std::shared_ptr<InferenceSession::RunContext> InferenceSession::createRunContext(const std::optional<RunOptions> &options)
+  {
+    auto context = std::make_shared<RunContext>();
+    if (options.has_value())
+    {
+      context->config = options;
+      context->tag = options->tag.value_or("");
+      applyRunOptions(context->options, options.value());
+      if (options->outputNames.has_value())
+      {
+        if (options->outputNames->empty())
+          throw std::runtime_error("outputNames must not be empty");
+        for (const auto &name : options->outputNames.value())
+        {
+          auto it = outputIndex_.find(name);
+          if (it == outputIndex_.end())
+            throw std::runtime_error("Output name not found: " + name);
+          context->outputs.push_back(it->second);
+        }
+      }
+    }
+
+    std::lock_guard<std::mutex> lock(runContextsMutex_);
+    // Forget runs that have finished since the last registration
+    runContexts_.erase(std::remove_if(runContexts_.begin(), runContexts_.end(),
+                                      [](const auto &entry)
+                                      { return entry.expired(); }),
+                       runContexts_.end());
+    runContexts_.push_back(context);
+    return context;
+  }
+
+  void InferenceSession::applyRunOptions(Ort::RunOptions &target, const RunOptions &options)
+  {
+    if (options.tag.has_value())
+      target.SetRunTag(options.tag->c_str());
+    if (options.logSeverityLevel.has_value())
+      target.SetRunLogSeverityLevel(static_cast<int>(options.logSeverityLevel.value()));
+    if (options.logVerbosityLevel.has_value())
+      target.SetRunLogVerbosityLevel(static_cast<int>(options.logVerbosityLevel.value()));
+    if (options.memoryArenaShrinkage.has_value())
+      target.AddConfigEntry("memory.enable_memory_arena_shrinkage", options.memoryArenaShrinkage->c_str());
+    if (options.configEntries.has_value())
+    {
+      for (const auto &[key, value] : options.configEntries.value())
+        target.AddConfigEntry(key.c_str(), value.c_str());
+    }
+  }
+
+  void InferenceSession::terminate(const std::optional<std::string> &tag)
+  {
+    {
+      std::lock_guard<std::mutex> lock(runContextsMutex_);
+      for (const auto &entry : runContexts_)
+      {
+        auto context = entry.lock();
+        if (!context || (tag.has_value() && context->tag != tag.value()))
+          continue;
+        context->terminated = true;
+        context->options.SetTerminate();
+        std::lock_guard<std::mutex> oneShotLock(context->oneShotMutex);
+        if (context->oneShot)
+          context->oneShot->SetTerminate();
+      }
+    }
+
+    // run() calls still waiting for a batch have no options and therefore no tag
+    if (!tag.has_value())
+    {
+      std::vector<PendingRun> pending;
+      {
+        std::lock_guard<std::mutex> lock(batchMutex_);
+        pending.swap(pendingRuns_);
+      }
+      for (auto &run : pending)
+      {
+        run.promise->reject(std::make_exception_ptr(std::runtime_error("Run was terminated")));
+      }
+    }
+  }
+
+  void InferenceSession::recordRun(std::chrono::steady_clock::duration latency, size_t bytesIn, size_t bytesOut)
+  {
+    int64_t nanos = std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+    runCount_.fetch_add(1, std::memory_order_relaxed);
+    totalRunNanos_.fetch_add(nanos, std::memory_order_relaxed);
+    lastRunNanos_.store(nanos, std::memory_order_relaxed);
+    bytesIn_.fetch_add(bytesIn, std::memory_order_relaxed);
+    bytesOut_.fetch_add(bytesOut, std::memory_order_relaxed);
+  }
+
+  RunStats InferenceSession::getStats()
+  {
+    RunStats stats;
+    stats.runCount = static_cast<double>(runCount_.load(std::memory_order_relaxed));
+    stats.totalLatencyMs = static_cast<double>(totalRunNanos_.load(std::memory_order_relaxed)) / 1e6;
+    stats.lastLatencyMs = static_cast<double>(lastRunNanos_.load(std::memory_order_relaxed)) / 1e6;
+    stats.bytesIn = static_cast<double>(bytesIn_.load(std::memory_order_relaxed));
+    stats.bytesOut = static_cast<double>(bytesOut_.load(std::memory_order_relaxed));
+    stats.bytesCopied = static_cast<double>(bytesCopied_.load(std::memory_order_relaxed));
+    stats.droppedFrames = static_cast<double>(droppedFrames_.load(std::memory_order_relaxed));
+
+    // ONNX Runtime doesn't expose its arena high-water mark, only the process peak is known
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    stats.processPeakRssBytes = static_cast<double>(usage.ru_maxrss);
+#else
+    stats.processPeakRssBytes = static_cast<double>(usage.ru_maxrss) * 1024.0;
+#endif
+    return stats;
+  }
+
+  size_t InferenceSession::residentMemoryBytes()
+  {
+#if defined(__APPLE__)
+    // The footprint iOS applies its memory limits to
+    task_vm_info_data_t info;
+    mach_msg_type_number_t count = TASK_VM_INFO_COUNT;
+    if (task_info(mach_task_self(), TASK_VM_INFO, reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS)
+      return 0;
+    return static_cast<size_t>(info.phys_footprint);
+#else
+    FILE *statm = std::fopen("/proc/self/statm", "r");
+    if (statm == nullptr)
+      return 0;
+    long totalPages = 0;
+    long residentPages = 0;
+    int fields = std::fscanf(statm, "%ld %ld", &totalPages, &residentPages);
+    std::fclose(statm);
+    return fields == 2 ? static_cast<size_t>(residentPages) * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#endif
+  }
+
+  MemoryUsage InferenceSession::getMemoryUsage()
+  {
+    MemoryUsage usage;
+    usage.modelBytes = static_cast<double>(footprint_.modelBytes);
+    usage.loadResidentBytes = static_cast<double>(footprint_.residentBytes);
+    usage.weightsVariant = footprint_.weightsVariant;
+    usage.residentBytes = static_cast<double>(residentMemoryBytes());
+    usage.evicted = isEvicted();
+    return usage;
+  }
+
+  void InferenceSession::resetStats()
+  {
+    runCount_ = 0;
+    totalRunNanos_ = 0;
+    lastRunNanos_ = 0;
+    bytesIn_ = 0;
+    bytesOut_ = 0;
+    bytesCopied_ = 0;
+    droppedFrames_ = 0;
+  }
+
+  std::shared_lock<std::shared_mutex> InferenceSession::lockSession()
+  {
+    std::shared_lock<std::shared_mutex> lock(sessionMutex_);
+    if (!session_ && evicted_)
+    {
+      lock.unlock();
+      {
+        std::unique_lock<std::shared_mutex> exclusiveLock(sessionMutex_);
+        // Another run may have reloaded it in the meantime
+        if (!session_ && evicted_)
+        {
+          session_ = reload_();
+          evicted_ = false;
+          loadedSession_ = session_.get();
+        }
+      }
+      // Make room for the reloaded session, this one is in use and stays
+      MemoryManager::shared().enforceBudget(this);
+      lock.lock();
+    }
+    if (!session_)
+    {
+      throw std::runtime_error("Session has already been disposed");
+    }
+    lastUsed_ = std::chrono::steady_clock::now().time_since_epoch().count();
+    return lock;
+  }
+
+  void InferenceSession::reloadInBackground()
+  {
+    if (!workerPool_ || reloadScheduled_.exchange(true))
+      return;
+    auto self = std::dynamic_pointer_cast<InferenceSession>(shared_from_this());
+    try
+    {
+      workerPool_->submit([self]()
+                          {
+        try
+        {
+          self->lockSession();
+        }
+        catch (const std::exception &e)
+        {
+          Logger::log(LogLevel::Error, "Onnxruntime", "Reloading an evicted session failed: %s", e.what());
+        }
+        self->reloadScheduled_ = false; });
+    }
+    catch (...)
+    {
+      // The queue is full, a later call tries again
+      reloadScheduled_ = false;
+    }
+  }
+
+  InferenceSession::RunOptionsScope::RunOptionsScope(InferenceSession &session, RunContext *context)
+      : context_(context), options_(context ? &context->options : &oneShot_)
+  {
+    // Runs that configure the shrinkage themselves keep their setting, a later run shrinks instead
+    bool shrinks = context && context->config.has_value() && context->config->memoryArenaShrinkage.has_value();
+    if (shrinks || !session.shrinkArenas_.exchange(false))
+      return;
+
+    // Requested under memory pressure, returns unused arena chunks once the run is done
+    oneShot_ = Ort::RunOptions();
+    if (context && context->config.has_value())
+      applyRunOptions(oneShot_, context->config.value());
+    oneShot_.AddConfigEntry("memory.enable_memory_arena_shrinkage", "cpu:0");
+    options_ = &oneShot_;
+    if (context)
+    {
+      // terminate() reaches the copy through the context while it runs
+      std::lock_guard<std::mutex> lock(context->oneShotMutex);
+      context->oneShot = &oneShot_;
+      if (context->terminated)
+        oneShot_.SetTerminate();
+    }
+  }
+
+  InferenceSession::RunOptionsScope::~RunOptionsScope()
+  {
+    if (context_ && context_->oneShot)
+    {
+      std::lock_guard<std::mutex> lock(context_->oneShotMutex);
+      context_->oneShot = nullptr;
+    }
+  }
+
+  void InferenceSession::setReloader(Reloader reload)
+  {
+    std::unique_lock<std::shared_mutex> lock(sessionMutex_);
+    reload_ = std::move(reload);
+  }
+
+  bool InferenceSession::evict()
+  {
+    // Only idle sessions are evicted, never wait for one. Bound outputs and carried state
+    // belong to the current sequence of runs and keep the session loaded.
+    if (activeRuns_ > 0 || stateful_ || profiling_)
+      return false;
+    std::unique_lock<std::mutex> bindingLock(bindingMutex_, std::try_to_lock);
+    if (!bindingLock.owns_lock() || !boundOutputs_.empty())
+      return false;
+    std::unique_lock<std::shared_mutex> lock(sessionMutex_, std::try_to_lock);
+    if (!lock.owns_lock() || !session_ || !reload_)
+      return false;
+
+    session_.reset();
+    evicted_ = true;
+    loadedSession_ = nullptr;
+    // Dropping the shared reference destroys the Ort::Session unless another holder still uses it
+    if (release_)
+      release_();
+    return true;
+  }
+
+  size_t InferenceSession::getEstimatedBytes() const
+  {
+    // Loads that joined an already loaded session didn't grow the resident set, count their model
+    return footprint_.residentBytes > 0 ? footprint_.residentBytes : footprint_.modelBytes;
+  }
+
+  std::chrono::steady_clock::time_point InferenceSession::getLastUsed() const
+  {
+    return std::chrono::steady_clock::time_point(std::chrono::steady_clock::duration(lastUsed_.load()));
+  }
+
+  std::string InferenceSession::endProfiling()
+  {
+    // Never reloads, this is called on the JS thread and a reloaded session would start a new profile
+    std::shared_lock<std::shared_mutex> lock(sessionMutex_);
+    // Profiled sessions are only evicted once their profile has ended, there is nothing left to end
+    if (!session_ && evicted_)
+      return "";
+    if (!session_)
+      throw std::runtime_error("Session has already been disposed");
+    profiling_ = false;
+
+    // Empty when profiling wasn't enabled for this session
+    Ort::AllocatorWithDefaultOptions allocator;
+    auto profilePath = session_->EndProfilingAllocated(allocator);
+    return std::string(profilePath.get());
+  }
+
+  void InferenceSession::dispose()
+  {
+    try
+    {
+      // A generation holds the session until it ends, stop it at its next step
+      if (generations_ > 0)
+      {
+        std::lock_guard<std::mutex> lock(runContextsMutex_);
+        for (const auto &entry : runContexts_)
+        {
+          auto context = entry.lock();
+          if (context && context->generation)
+            context->terminated = true;
+        }
+      }
+
+      // Wait for in-flight runs before tearing the session down
+      std::lock_guard<std::mutex> bindingLock(bindingMutex_);
+      std::unique_lock<std::shared_mutex> lock(sessionMutex_);
+
+      // The binding and the carried state reference the session, release them first
+      ioBinding_.reset();
+      boundOutputs_.clear();
+      {
+        std::lock_guard<std::mutex> stateLock(stateMutex_);
+        stateSlots_.clear();
+        stateful_ = false;
+      }
+
       // Clear any stored input/output metadata
       inputNames_.clear();
       outputNames_.clear();
+      outputNamesC_.clear();
+      inputIndex_.clear();
+      outputIndex_.clear();
+      inputPlans_.clear();
+      outputPlans_.clear();
 
-      // Reset the session (this will call the destructor of Ort::Session)
-      if (session_)
+      // Drop this reference to the session, the Ort::Session is destroyed once no other
+      // InferenceSession shares it. Evicted sessions have already dropped theirs.
+      bool holdsSession = session_ != nullptr;
+      session_.reset();
+      evicted_ = false;
+      loadedSession_ = nullptr;
+      reload_ = nullptr;
+      if (release_)
       {
-        session_.reset();
+        auto release = std::move(release_);
+        release_ = nullptr;
+        if (holdsSession)
+          release();
       }
     }
     catch (const std::exception &e)
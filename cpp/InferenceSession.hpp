@@ -1,23 +1,52 @@
 #pragma once
 
 #include "HybridInferenceSessionSpec.hpp"
+#include "ImagePreprocessor.hpp"
+#include "Postprocessor.hpp"
+#include "WorkerPool.hpp"
 #include "onnxruntime_cxx_api.h"
+#include <NitroModules/Promise.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <type_traits>
 #include <unordered_map>
+#include <variant>
 #include <vector>
 
 namespace margelo::nitro::nitroonnxruntime
 {
 
+  // What loading a model took, reported by InferenceSession::getMemoryUsage()
+  struct LoadFootprint
+  {
+    size_t modelBytes = 0;
+    size_t residentBytes = 0; // Resident memory growth while the session was created
+    std::string weightsVariant;
+  };
+
   class InferenceSession : public virtual HybridInferenceSessionSpec
   {
   public:
+    // Feeds are either a bare ArrayBuffer or an ArrayBuffer with explicit dims
+    using FeedMap = std::unordered_map<std::string, std::variant<std::shared_ptr<ArrayBuffer>, TensorFeed>>;
+
     InferenceSession() : HybridObject(TAG) {}
     // Constructor
-    InferenceSession(std::unique_ptr<Ort::Session> session)
-        : HybridObject(TAG), session_(std::move(session))
+    // `release` is called whenever the session lets go of its Ort::Session (dispose or evict),
+    // e.g. to drop a shared session reference
+    InferenceSession(std::shared_ptr<Ort::Session> session, std::shared_ptr<WorkerPool> workerPool,
+                     std::function<void()> release = nullptr, LoadFootprint footprint = {})
+        : HybridObject(TAG), session_(std::move(session)), workerPool_(std::move(workerPool)), release_(std::move(release)),
+          footprint_(std::move(footprint))
     {
       initializeIONames();
+      loadedSession_ = session_.get();
     }
 
     // Destructor - will be called automatically when shared_ptr ref count hits 0
@@ -32,15 +61,297 @@ namespace margelo::nitro::nitroonnxruntime
     std::vector<Tensor> getInputNames() override;
     std::vector<Tensor> getOutputNames() override;
     std::shared_ptr<Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>> run(
-        const std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> &feeds) override;
+        const FeedMap &feeds, const std::optional<RunOptions> &options) override;
+    std::optional<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>> runSync(
+        const FeedMap &feeds, const std::optional<RunOptions> &options, const std::optional<bool> &dropIfBusy) override;
+    void terminate(const std::optional<std::string> &tag) override;
+    void bindOutputs(const FeedMap &outputs) override;
+    void clearBoundOutputs() override;
+    std::shared_ptr<Promise<void>> runBound(const FeedMap &feeds, const std::optional<RunOptions> &options) override;
+    std::shared_ptr<Promise<std::vector<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>>> runBatch(
+        const std::vector<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>> &feeds) override;
+    void setAutoBatching(const std::optional<AutoBatchingOptions> &options) override;
+    std::shared_ptr<Promise<BenchmarkResult>> benchmark(const BenchmarkOptions &options) override;
+    void enableState(const std::unordered_map<std::string, std::string> &outputToInput,
+                     const std::optional<std::unordered_map<std::string, std::vector<double>>> &initialShapes) override;
+    void disableState() override;
+    void resetState() override;
+    void setImagePreprocessing(const std::string &inputName, const std::optional<ImagePreprocessing> &options) override;
+    void setPostprocessing(const std::string &outputName, const std::optional<Postprocessing> &options) override;
+    std::shared_ptr<Promise<std::vector<double>>> generate(const GenerateOptions &options,
+                                                           const std::optional<std::function<void(double)>> &onToken) override;
+    RunStats getStats() override;
+    MemoryUsage getMemoryUsage() override;
+    void resetStats() override;
+    std::string endProfiling() override;
+    bool getZeroCopyInputs() override;
+    void setZeroCopyInputs(bool zeroCopyInputs) override;
+    bool getConvertHalfPrecision() override;
+    void setConvertHalfPrecision(bool convertHalfPrecision) override;
     void dispose() override;
 
+    // Current resident memory of the whole process
+    static size_t residentMemoryBytes();
+
+    // Memory management, driven by MemoryManager
+    // Recreates the Ort::Session of the same model after evict()
+    using Reloader = std::function<std::shared_ptr<Ort::Session>()>;
+    void setReloader(Reloader reload);
+    // Releases the Ort::Session if the session is idle and can be reloaded, the next run reloads it
+    bool evict();
+    bool isEvicted() const { return evicted_; }
+    // Holds its Ort::Session, neither evicted nor disposed
+    bool isLoaded() const { return loadedSession_ != nullptr; }
+    // The Ort::Session held while loaded, the same for every handle sharing it
+    const Ort::Session *getLoadedSession() const { return loadedSession_; }
+    // Whether the session allocates from a CPU arena (enableCpuMemArena), which runs can shrink
+    void setArenaEnabled(bool enabled) { arenaEnabled_ = enabled; }
+    // Profiled sessions stay loaded until endProfiling(), evicting them would end the profile
+    void setProfiling(bool profiling) { profiling_ = profiling; }
+    // Sessions with the same group, like the replicas of a pool, are counted and evicted together
+    void setEvictionGroup(std::shared_ptr<const void> group) { evictionGroup_ = std::move(group); }
+    const void *getEvictionGroup() const { return evictionGroup_.get(); }
+    // Has the next run give unused arena memory back to the system
+    void requestArenaShrink()
+    {
+      if (arenaEnabled_)
+        shrinkArenas_ = true;
+    }
+    // Memory the session is assumed to hold while it is loaded
+    size_t getEstimatedBytes() const;
+    std::chrono::steady_clock::time_point getLastUsed() const;
+
+    // Precomputed per input/output metadata so that runs don't have to look at type strings
+    struct TensorPlan
+    {
+      std::string name;
+      ONNXTensorElementDataType type = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+      size_t elementSize = 0;     // 0 for strings
+      std::vector<int64_t> dims;  // Model shape, negative for dynamic dimensions
+      std::vector<std::string> symbolicDims; // Names of the dimensions, empty for unnamed ones
+      int dynamicDim = -1;        // Index of the dynamic dimension if there is exactly one
+      size_t dynamicDimCount = 0;
+      int64_t fixedElements = 1; // Product of all fixed dimensions
+    };
+
   private:
-    std::unique_ptr<Ort::Session> session_;
+    // Runs its replicas' pinned feeds directly on its own threads
+    friend class SessionPool;
+
+    std::shared_ptr<Ort::Session> session_;
+    std::shared_ptr<WorkerPool> workerPool_;
+    std::function<void()> release_;
+    LoadFootprint footprint_;
+    // Held shared by in-flight runs and exclusively by dispose(), evict() and reloads
+    std::shared_mutex sessionMutex_;
+    Reloader reload_;
+    std::atomic<bool> evicted_{false}; // session_ was released by evict() rather than dispose()
+    std::atomic<const Ort::Session *> loadedSession_{nullptr}; // session_, readable without sessionMutex_
+    std::atomic<bool> reloadScheduled_{false};
+    std::atomic<bool> arenaEnabled_{true};
+    std::atomic<bool> profiling_{false};
+    std::atomic<bool> shrinkArenas_{false};
+    std::shared_ptr<const void> evictionGroup_; // Set once before the session is tracked
+    std::atomic<int64_t> lastUsed_{0}; // steady_clock ticks of the last run
     std::vector<Tensor> inputNames_;
     std::vector<Tensor> outputNames_;
+    std::vector<TensorPlan> inputPlans_;
+    std::vector<TensorPlan> outputPlans_;
+    std::unordered_map<std::string, size_t> inputIndex_;
+    std::unordered_map<std::string, size_t> outputIndex_;
+    std::vector<const char *> outputNamesC_;
+    Ort::MemoryInfo memoryInfo_{nullptr};
+    bool zeroCopyInputs_ = false;
+    // float16/bfloat16 tensors are fed and returned as float32, read by runs on worker threads
+    std::atomic<bool> convertHalfPrecision_{false};
+
+    // Feed memory resolved on the JS thread, `buffer` keeps it alive until the run has finished
+    struct PinnedFeed
+    {
+      std::shared_ptr<ArrayBuffer> buffer;
+      uint8_t *data;
+      size_t byteSize;
+      std::vector<int64_t> dims; // Explicit shape, empty to infer it from the model and byteSize
+      // Set for raw frames, which are converted into the input tensor on the worker thread
+      std::shared_ptr<const ImagePreprocessor> preprocessor;
+      // Holds float32 values for a float16/bfloat16 input, converted when the tensor is created
+      bool float32 = false;
+    };
+    using PinnedFeeds = std::unordered_map<std::string, PinnedFeed>;
+
+    // Guards preprocessors_ and postprocessors_, runSync() reads them from frame processor threads
+    std::mutex processorsMutex_;
+    // Inputs fed as raw frames
+    std::unordered_map<std::string, std::shared_ptr<const ImagePreprocessor>> preprocessors_;
+
+    using BufferMap = std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>;
+
+    // Time spent in each phase of a run, reported by benchmark()
+    struct RunTimings
+    {
+      std::chrono::steady_clock::duration tensorCreation{0};
+      std::chrono::steady_clock::duration run{0};
+      std::chrono::steady_clock::duration outputs{0};
+    };
+
+    // Postprocessors by output index. Replaced as a whole, runs keep the map they started with.
+    using PostprocessorMap = std::unordered_map<size_t, std::shared_ptr<const Postprocessor>>;
+    std::shared_ptr<const PostprocessorMap> postprocessors_;
+
+    // Options of a single run, reachable from terminate() while the run is queued or running.
+    // Jobs hold the only strong reference, so contexts expire once their run is done.
+    struct RunContext
+    {
+      Ort::RunOptions options;
+      std::optional<RunOptions> config; // What `options` was created from
+      // One-shot copy of `options` for the current Run() call, see RunOptionsScope. A pool's
+      // replicas run contexts of the first replica, so the copy has a mutex of its own.
+      std::mutex oneShotMutex;
+      Ort::RunOptions *oneShot = nullptr;
+      std::string tag;
+      std::atomic<bool> terminated{false};
+      // Indices into outputPlans_ of the requested outputs, empty for all of them
+      std::vector<size_t> outputs;
+      std::shared_ptr<const PostprocessorMap> postprocessors;
+      bool generation = false; // Stopped by dispose(), which would wait for the whole generation otherwise
+    };
+    std::mutex runContextsMutex_;
+    std::vector<std::weak_ptr<RunContext>> runContexts_;
+
+    // An output carried over natively into an input of the next run, e.g. a KV cache
+    struct StateSlot
+    {
+      size_t output;
+      size_t input;
+      std::vector<int64_t> initialShape; // Shape of the state a sequence starts from, empty to derive it from the feeds
+      Ort::Value value{nullptr};         // Empty before the first run and after resetState()
+    };
+    // Held for the duration of stateful runs, which have to happen one after the other
+    std::mutex stateMutex_;
+    std::vector<StateSlot> stateSlots_; // Empty while state is disabled
+    // Mirrors !stateSlots_.empty() for checks that mustn't wait for a stateful run
+    std::atomic<bool> stateful_{false};
+    // generate() calls in progress, each holds the session and its state until it ends
+    std::atomic<uint32_t> generations_{0};
+
+    // run() calls waiting to be stacked into one batch while auto-batching is enabled
+    struct PendingRun
+    {
+      PinnedFeeds feeds;
+      std::shared_ptr<Promise<BufferMap>> promise;
+    };
+    std::mutex batchMutex_;
+    std::condition_variable batchCondition_;
+    std::vector<PendingRun> pendingRuns_;
+    size_t maxBatchSize_ = 0; // 0 means auto-batching is disabled
+    std::chrono::microseconds maxBatchWait_{0};
+    bool batchScheduled_ = false;
+
+    // Always-on counters behind getStats(), cheap enough to keep in release builds
+    std::atomic<uint64_t> runCount_{0};
+    std::atomic<int64_t> totalRunNanos_{0};
+    std::atomic<int64_t> lastRunNanos_{0};
+    std::atomic<uint64_t> bytesIn_{0};
+    std::atomic<uint64_t> bytesOut_{0};
+    std::atomic<uint64_t> bytesCopied_{0};
+    std::atomic<uint64_t> droppedFrames_{0};
+    // Runs currently executing on any thread, runSync() drops frames while this isn't 0
+    std::atomic<uint32_t> activeRuns_{0};
+
+    // Caller-owned output buffers for runBound(), guarded by bindingMutex_. The binding is created
+    // by the first runBound() on a worker thread, where an evicted session can be reloaded.
+    std::unique_ptr<Ort::IoBinding> ioBinding_;
+    PinnedFeeds boundOutputs_;
+    std::mutex bindingMutex_;
 
     void initializeIONames();
+    // Shared lock on the session for a run, reloading it first if it has been evicted
+    std::shared_lock<std::shared_mutex> lockSession();
+    // Reloads an evicted session on the worker pool, for calls that mustn't block on a reload
+    void reloadInBackground();
+    // Options for one Session::Run() call. A run that gives arena memory back under memory pressure
+    // gets a one-shot copy of its context's options, so that long-lived contexts (generate(), pool
+    // runs) don't keep shrinking on every later step.
+    class RunOptionsScope
+    {
+    public:
+      RunOptionsScope(InferenceSession &session, RunContext *context);
+      ~RunOptionsScope();
+      Ort::RunOptions &get() { return *options_; }
+
+    private:
+      RunContext *context_;
+      Ort::RunOptions oneShot_{nullptr};
+      Ort::RunOptions *options_;
+    };
+    static void applyRunOptions(Ort::RunOptions &target, const RunOptions &options);
+    void recordRun(std::chrono::steady_clock::duration latency, size_t bytesIn, size_t bytesOut);
+    const TensorPlan &getInputPlan(const std::string &name) const;
+    const TensorPlan &getOutputPlan(const std::string &name) const;
+    // `countCopies` is false for copies that aren't part of a run, e.g. a benchmark's feeds
+    PinnedFeed pinFeed(const std::shared_ptr<ArrayBuffer> &buffer, std::vector<int64_t> dims, bool copy,
+                       bool countCopies = true);
+    PinnedFeeds pinFeeds(const FeedMap &feeds, bool copy, bool countCopies = true);
+    PinnedFeeds pinFeeds(const std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> &feeds);
+    void attachPreprocessors(PinnedFeeds &feeds);
+    void markFloat32Feeds(PinnedFeeds &feeds) const;
+    Ort::Value createInputTensor(const TensorPlan &plan, const PinnedFeed &feed) const;
+    // Runs inference synchronously on the calling thread
+    std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>> runInternal(const PinnedFeeds &feeds,
+                                                                              RunContext *context = nullptr);
+    // Runs inference with the session already locked, carrying `stateSlots` over. Runs timed
+    // through `timings` are benchmark runs and are left out of getStats().
+    BufferMap runLocked(const PinnedFeeds &feeds, RunContext *context, RunTimings *timings,
+                        std::vector<StateSlot> &stateSlots);
+    void runBoundInternal(const PinnedFeeds &feeds, RunContext *context);
+    // Stacks the requests along the batch dimension, runs them once and slices the outputs back
+    std::vector<BufferMap> runBatchInternal(const std::vector<PinnedFeeds> &requests, RunContext *context = nullptr);
+    // Creates the run's Ort::RunOptions and registers it for terminate()
+    std::shared_ptr<RunContext> createRunContext(const std::optional<RunOptions> &options);
+    void collectBatch();
+    std::vector<double> generateInternal(const GenerateOptions &options, const std::function<void(double)> &onToken,
+                                         RunContext *context);
+    // Throws while generate() holds the state
+    void rejectWhileGenerating() const;
+    BenchmarkResult benchmarkInternal(const PinnedFeeds &feeds, size_t warmup, size_t iterations);
+
+    // Runs `job` on the worker pool and settles the returned Promise with its result
+    template <typename T, typename Job>
+    std::shared_ptr<Promise<T>> dispatch(Job &&job)
+    {
+      auto promise = Promise<T>::create();
+      try
+      {
+        if (!workerPool_)
+        {
+          throw std::runtime_error("Session has no worker pool, it must be created through Onnxruntime.loadModel");
+        }
+
+        workerPool_->submit([promise, job = std::forward<Job>(job)]() mutable
+                            {
+          try
+          {
+            if constexpr (std::is_void_v<T>)
+            {
+              job();
+              promise->resolve();
+            }
+            else
+            {
+              promise->resolve(job());
+            }
+          }
+          catch (...)
+          {
+            promise->reject(std::current_exception());
+          } });
+      }
+      catch (...)
+      {
+        promise->reject(std::current_exception());
+      }
+      return promise;
+    }
   };
 
 } // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,227 @@
+#include "MappedModel.hpp"
+#include <NitroModules/NitroLogger.hpp>
+#include <climits>
+#include <cstring>
+#include <fcntl.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__ANDROID__)
+#include <android/asset_manager_jni.h>
+#endif
+
+#if defined(__APPLE__)
+#include <CoreFoundation/CoreFoundation.h>
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    // ORT-format models are flatbuffers with the "ORTM" file identifier at offset 4
+    constexpr size_t ORT_FORMAT_IDENTIFIER_OFFSET = 4;
+    constexpr const char *ORT_FORMAT_IDENTIFIER = "ORTM";
+
+    bool hasOrtFormatIdentifier(const void *data, size_t size)
+    {
+      return size >= ORT_FORMAT_IDENTIFIER_OFFSET + 4 &&
+             std::memcmp(static_cast<const uint8_t *>(data) + ORT_FORMAT_IDENTIFIER_OFFSET, ORT_FORMAT_IDENTIFIER, 4) == 0;
+    }
+
+    std::string stripFileScheme(const std::string &path)
+    {
+      return path.rfind("file://", 0) == 0 ? path.substr(7) : path;
+    }
+
+#if defined(__ANDROID__)
+    std::mutex assetManagerMutex;
+    jobject assetManagerRef = nullptr;
+    AAssetManager *assetManager = nullptr;
+#endif
+
+#if defined(__APPLE__)
+    // Path of a file in the main bundle's resources
+    std::string bundleResourcePath(const std::string &assetPath)
+    {
+      CFBundleRef bundle = CFBundleGetMainBundle();
+      CFURLRef resourcesUrl = bundle != nullptr ? CFBundleCopyResourcesDirectoryURL(bundle) : nullptr;
+      if (resourcesUrl == nullptr)
+      {
+        throw std::runtime_error("Main bundle is not available");
+      }
+
+      char resourcesPath[PATH_MAX];
+      bool resolved = CFURLGetFileSystemRepresentation(resourcesUrl, true, reinterpret_cast<UInt8 *>(resourcesPath), PATH_MAX);
+      CFRelease(resourcesUrl);
+      if (!resolved)
+      {
+        throw std::runtime_error("Failed to resolve the main bundle path");
+      }
+      return std::string(resourcesPath) + "/" + assetPath;
+    }
+#endif
+  } // namespace
+
+  MappedModel::~MappedModel()
+  {
+    if (mapping_ != nullptr)
+    {
+      munmap(mapping_, size_);
+    }
+#if defined(__ANDROID__)
+    if (asset_ != nullptr)
+    {
+      AAsset_close(asset_);
+    }
+#endif
+  }
+
+  std::shared_ptr<MappedModel> MappedModel::mapFile(const std::string &path)
+  {
+    std::string filePath = stripFileScheme(path);
+    int fd = open(filePath.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+      throw std::runtime_error("Failed to open model file: " + filePath);
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0)
+    {
+      close(fd);
+      throw std::runtime_error("Failed to read size of model file: " + filePath);
+    }
+
+    size_t size = static_cast<size_t>(fileStat.st_size);
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+      throw std::runtime_error("Failed to map model file: " + filePath);
+    }
+
+    auto model = std::shared_ptr<MappedModel>(new MappedModel());
+    model->mapping_ = mapping;
+    model->data_ = mapping;
+    model->size_ = size;
+    return model;
+  }
+
+  std::shared_ptr<MappedModel> MappedModel::mapAsset(const std::string &assetPath)
+  {
+#if defined(__ANDROID__)
+    std::lock_guard<std::mutex> lock(assetManagerMutex);
+    if (assetManager == nullptr)
+    {
+      throw std::runtime_error("Android AssetManager is not available yet");
+    }
+
+    AAsset *asset = AAssetManager_open(assetManager, assetPath.c_str(), AASSET_MODE_BUFFER);
+    if (asset == nullptr)
+    {
+      throw std::runtime_error("Asset not found: " + assetPath);
+    }
+
+    // Only assets stored uncompressed in the APK have a file descriptor, and only those are mapped
+    // by AAsset_getBuffer(). Compressed ones are inflated onto the heap, the copy this is meant to avoid.
+    off64_t start = 0;
+    off64_t length = 0;
+    int fd = AAsset_openFileDescriptor64(asset, &start, &length);
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    else
+    {
+      Logger::log(LogLevel::Warning, "Onnxruntime",
+                  "Asset %s is compressed and gets copied into memory, add its extension to "
+                  "androidResources.noCompress in build.gradle to map it instead",
+                  assetPath.c_str());
+    }
+
+    const void *data = AAsset_getBuffer(asset);
+    if (data == nullptr)
+    {
+      AAsset_close(asset);
+      throw std::runtime_error("Failed to map asset: " + assetPath);
+    }
+
+    auto model = std::shared_ptr<MappedModel>(new MappedModel());
+    model->asset_ = asset;
+    model->data_ = data;
+    model->size_ = static_cast<size_t>(AAsset_getLength64(asset));
+    return model;
+#elif defined(__APPLE__)
+    return mapFile(bundleResourcePath(assetPath));
+#else
+    throw std::runtime_error("Loading models from assets is not supported on this platform");
+#endif
+  }
+
+  std::optional<size_t> MappedModel::fileSize(const std::string &path)
+  {
+    struct stat fileStat;
+    if (stat(stripFileScheme(path).c_str(), &fileStat) != 0 || !S_ISREG(fileStat.st_mode))
+      return std::nullopt;
+    return static_cast<size_t>(fileStat.st_size);
+  }
+
+  std::optional<size_t> MappedModel::assetSize(const std::string &assetPath)
+  {
+#if defined(__ANDROID__)
+    std::lock_guard<std::mutex> lock(assetManagerMutex);
+    if (assetManager == nullptr)
+    {
+      throw std::runtime_error("Android AssetManager is not available yet");
+    }
+
+    AAsset *asset = AAssetManager_open(assetManager, assetPath.c_str(), AASSET_MODE_UNKNOWN);
+    if (asset == nullptr)
+      return std::nullopt;
+    size_t size = static_cast<size_t>(AAsset_getLength64(asset));
+    AAsset_close(asset);
+    return size;
+#elif defined(__APPLE__)
+    return fileSize(bundleResourcePath(assetPath));
+#else
+    throw std::runtime_error("Loading models from assets is not supported on this platform");
+#endif
+  }
+
+  bool MappedModel::isOrtFormatFile(const std::string &path)
+  {
+    int fd = open(stripFileScheme(path).c_str(), O_RDONLY);
+    if (fd < 0)
+      return false;
+
+    uint8_t header[ORT_FORMAT_IDENTIFIER_OFFSET + 4];
+    ssize_t bytesRead = read(fd, header, sizeof(header));
+    close(fd);
+    return bytesRead == static_cast<ssize_t>(sizeof(header)) && hasOrtFormatIdentifier(header, sizeof(header));
+  }
+
+  bool MappedModel::isOrtFormat() const
+  {
+    return hasOrtFormatIdentifier(data_, size_);
+  }
+
+#if defined(__ANDROID__)
+  void MappedModel::setAssetManager(JNIEnv *env, jobject javaAssetManager)
+  {
+    std::lock_guard<std::mutex> lock(assetManagerMutex);
+    if (assetManagerRef != nullptr)
+    {
+      return;
+    }
+    // The native AAssetManager is only valid while the Java object is alive, keep it referenced
+    assetManagerRef = env->NewGlobalRef(javaAssetManager);
+    assetManager = AAssetManager_fromJava(env, assetManagerRef);
+  }
+#endif
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#if defined(__ANDROID__)
+#include <android/asset_manager.h>
+#include <jni.h>
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Read-only memory mapping of a model, so that its pages are loaded lazily by the OS
+  // instead of the whole model being copied onto the heap.
+  class MappedModel
+  {
+  public:
+    ~MappedModel();
+
+    MappedModel(const MappedModel &) = delete;
+    MappedModel &operator=(const MappedModel &) = delete;
+
+    // Maps a file from disk
+    static std::shared_ptr<MappedModel> mapFile(const std::string &path);
+    // Maps a file bundled with the app, from the APK assets on Android and the main bundle on iOS.
+    // Compressed APK assets can't be mapped, they are inflated into memory with a warning.
+    static std::shared_ptr<MappedModel> mapAsset(const std::string &assetPath);
+
+    // Size of a file on disk or bundled with the app, nullopt if it doesn't exist
+    static std::optional<size_t> fileSize(const std::string &path);
+    static std::optional<size_t> assetSize(const std::string &assetPath);
+
+    // Whether the file starts like a serialized ORT-format model
+    static bool isOrtFormatFile(const std::string &path);
+
+    const void *data() const { return data_; }
+    size_t size() const { return size_; }
+    // ORT-format models can be used directly from the mapping, including their initializers
+    bool isOrtFormat() const;
+
+#if defined(__ANDROID__)
+    // Called from Java with the application's AssetManager, required for mapAsset()
+    static void setAssetManager(JNIEnv *env, jobject assetManager);
+#endif
+
+  private:
+    MappedModel() = default;
+
+    const void *data_ = nullptr;
+    size_t size_ = 0;
+    // Set when the memory was mapped with mmap() and has to be unmapped
+    void *mapping_ = nullptr;
+#if defined(__ANDROID__)
+    AAsset *asset_ = nullptr;
+#endif
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
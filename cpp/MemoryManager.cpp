@@ -0,0 +1,160 @@
+#include "MemoryManager.hpp"
+#include "InferenceSession.hpp"
+#include <NitroModules/NitroLogger.hpp>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+#if defined(__APPLE__)
+  namespace
+  {
+    // The same memory pressure events UIKit's memory warnings are based on, without needing UIKit
+    void observeMemoryPressure()
+    {
+      static dispatch_source_t source = dispatch_source_create(DISPATCH_SOURCE_TYPE_MEMORYPRESSURE, 0,
+                                                               DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+                                                               dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+      dispatch_source_set_event_handler_f(source, [](void *)
+                                          {
+        unsigned long level = dispatch_source_get_data(source);
+        MemoryManager::shared().handlePressure((level & DISPATCH_MEMORYPRESSURE_CRITICAL) != 0
+                                                   ? MemoryManager::Pressure::Critical
+                                                   : MemoryManager::Pressure::Moderate); });
+      dispatch_resume(source);
+    }
+  } // namespace
+#endif
+
+  MemoryManager &MemoryManager::shared()
+  {
+    // Never destroyed, platform callbacks may still arrive during shutdown
+    static MemoryManager *manager = new MemoryManager();
+    return *manager;
+  }
+
+  MemoryManager::MemoryManager()
+  {
+#if defined(__APPLE__)
+    observeMemoryPressure();
+#endif
+  }
+
+  void MemoryManager::track(const std::shared_ptr<InferenceSession> &session)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Forget sessions that have been garbage collected since
+    sessions_.erase(std::remove_if(sessions_.begin(), sessions_.end(),
+                                   [](const auto &entry)
+                                   { return entry.expired(); }),
+                    sessions_.end());
+    sessions_.push_back(session);
+  }
+
+  void MemoryManager::setBudget(size_t bytes)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    budget_ = bytes;
+    if (budget_ > 0)
+      evictUntil(budget_, nullptr);
+  }
+
+  void MemoryManager::enforceBudget(const InferenceSession *inUse)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (budget_ > 0)
+      evictUntil(budget_, inUse);
+  }
+
+  void MemoryManager::handlePressure(Pressure pressure)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    Logger::log(LogLevel::Info, "Onnxruntime", "Handling %s memory pressure",
+                pressure == Pressure::Critical ? "critical" : "moderate");
+
+    // Arenas only shrink at the end of a run, so this pays off for sessions that keep running
+    for (const auto &entry : sessions_)
+    {
+      if (auto session = entry.lock())
+        session->requestArenaShrink();
+    }
+
+    if (pressure == Pressure::Critical)
+      evictUntil(0, nullptr);
+    else if (budget_ > 0)
+      evictUntil(budget_ / 2, nullptr);
+  }
+
+  void MemoryManager::evictUntil(size_t target, const InferenceSession *inUse)
+  {
+    // Handles loaded from the same registry entry share one Ort::Session, which is only freed
+    // once all of them have let go of it. Count and evict them together, along with the other
+    // sessions of their eviction group.
+    struct SharedSession
+    {
+      std::vector<std::shared_ptr<InferenceSession>> holders;
+      std::unordered_map<const void *, size_t> ortSessionBytes;
+      size_t bytes = 0;
+      std::chrono::steady_clock::time_point lastUsed;
+      bool inUse = false;
+    };
+    std::unordered_map<const void *, SharedSession> shared;
+    for (const auto &entry : sessions_)
+    {
+      auto session = entry.lock();
+      const void *ortSession = session ? session->getLoadedSession() : nullptr;
+      if (!ortSession)
+        continue;
+      const void *groupKey = session->getEvictionGroup() ? session->getEvictionGroup() : ortSession;
+      SharedSession &group = shared[groupKey];
+      size_t &bytes = group.ortSessionBytes[ortSession];
+      bytes = std::max(bytes, session->getEstimatedBytes());
+      group.lastUsed = std::max(group.lastUsed, session->getLastUsed());
+      group.inUse = group.inUse || session.get() == inUse;
+      group.holders.push_back(std::move(session));
+    }
+
+    std::vector<SharedSession *> loaded;
+    size_t usage = 0;
+    for (auto &[groupKey, group] : shared)
+    {
+      for (const auto &[ortSession, bytes] : group.ortSessionBytes)
+        group.bytes += bytes;
+      usage += group.bytes;
+      loaded.push_back(&group);
+    }
+
+    std::sort(loaded.begin(), loaded.end(), [](const SharedSession *a, const SharedSession *b)
+              { return a->lastUsed < b->lastUsed; });
+    for (SharedSession *group : loaded)
+    {
+      if (usage <= target)
+        break;
+      if (group->inUse)
+        continue;
+      bool freed = true;
+      for (const auto &session : group->holders)
+      {
+        freed = session->evict() && freed;
+      }
+      // A busy holder keeps the Ort::Session alive, the others reload by joining it
+      if (!freed)
+        continue;
+      usage -= group->bytes;
+      Logger::log(LogLevel::Info, "Onnxruntime", "Evicted an idle session of %zu bytes held by %zu handles", group->bytes,
+                  group->holders.size());
+    }
+
+    if (usage > target && target > 0)
+    {
+      Logger::log(LogLevel::Warning, "Onnxruntime", "Sessions in use need %zu bytes, over the target of %zu", usage, target);
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  class InferenceSession;
+
+  // Keeps loaded sessions within a memory budget by evicting idle ones, least recently used first.
+  // Handles sharing an Ort::Session and the replicas of a session pool are counted and evicted
+  // as one. Evicted sessions reload on
+  // their next run. Process wide, so that every Onnxruntime instance
+  // and the platform's memory warnings work against the same budget.
+  class MemoryManager
+  {
+  public:
+    enum class Pressure
+    {
+      Moderate, // Shrink arenas and evict down to half the budget
+      Critical  // Shrink arenas and evict every idle session
+    };
+
+    static MemoryManager &shared();
+
+    MemoryManager(const MemoryManager &) = delete;
+    MemoryManager &operator=(const MemoryManager &) = delete;
+
+    void track(const std::shared_ptr<InferenceSession> &session);
+    // 0 disables the budget
+    void setBudget(size_t bytes);
+    // Evicts idle sessions until the loaded ones fit the budget. `inUse` is never evicted.
+    void enforceBudget(const InferenceSession *inUse = nullptr);
+    void handlePressure(Pressure pressure);
+
+  private:
+    MemoryManager();
+
+    std::mutex mutex_;
+    size_t budget_ = 0;
+    std::vector<std::weak_ptr<InferenceSession>> sessions_;
+
+    // Has to be called with mutex_ held
+    void evictUntil(size_t target, const InferenceSession *inUse);
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,291 @@
+#include "ModelCache.hpp"
+#include "onnxruntime_cxx_api.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <vector>
+#include <stdexcept>
+#include <system_error>
+#include <unistd.h>
+#include <variant>
+
+namespace fs = std::filesystem;
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  uint64_t hashBytes(const void *data, size_t size, uint64_t seed)
+  {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint64_t hash = seed;
+    for (size_t i = 0; i < size; i++)
+    {
+      hash ^= bytes[i];
+      hash *= 1099511628211ULL;
+    }
+    return hash;
+  }
+
+  namespace
+  {
+    constexpr uint64_t PRIME_1 = 0x9E3779B185EBCA87ULL;
+    constexpr uint64_t PRIME_2 = 0xC2B2AE3D27D4EB4FULL;
+    constexpr uint64_t PRIME_3 = 0x165667B19E3779F9ULL;
+
+    uint64_t rotateLeft(uint64_t value, int bits)
+    {
+      return (value << bits) | (value >> (64 - bits));
+    }
+  } // namespace
+
+  uint64_t hashModel(const void *data, size_t size)
+  {
+    // xxHash64-style rounds over four independent lanes of 8-byte words, which runs at memory
+    // speed instead of FNV-1a's dependent multiply per byte
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    uint64_t lanes[4] = {PRIME_1 + PRIME_2, PRIME_2, 0, 0 - PRIME_1};
+    size_t offset = 0;
+    for (; offset + 32 <= size; offset += 32)
+    {
+      for (int lane = 0; lane < 4; lane++)
+      {
+        uint64_t word;
+        std::memcpy(&word, bytes + offset + lane * 8, sizeof(word));
+        lanes[lane] = rotateLeft(lanes[lane] + word * PRIME_2, 31) * PRIME_1;
+      }
+    }
+
+    uint64_t hash = rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18);
+    hash = hashBytes(bytes + offset, size - offset, hash ^ static_cast<uint64_t>(size));
+    hash ^= hash >> 33;
+    hash *= PRIME_2;
+    hash ^= hash >> 29;
+    hash *= PRIME_3;
+    hash ^= hash >> 32;
+    return hash;
+  }
+
+  std::string describeSessionOptions(const std::optional<SessionOptions> &options)
+  {
+    std::string description;
+    if (!options.has_value())
+      return description;
+
+    if (options->graphOptimizationLevel.has_value())
+      description += ";opt=" + options->graphOptimizationLevel.value();
+
+    if (options->executionProviders.has_value())
+    {
+      description += ";ep=";
+      for (const auto &provider : options->executionProviders.value())
+      {
+        if (std::holds_alternative<std::string>(provider))
+        {
+          description += std::get<std::string>(provider) + ",";
+        }
+        else
+        {
+          description += std::get<ProviderOptions>(provider).name + ",";
+        }
+      }
+    }
+
+    if (options->freeDimensionOverrides.has_value())
+    {
+      // Sorted so that the description doesn't depend on map iteration order
+      std::map<std::string, double> overrides(options->freeDimensionOverrides->begin(),
+                                              options->freeDimensionOverrides->end());
+      description += ";dims=";
+      for (const auto &[name, value] : overrides)
+      {
+        description += name + ":" + std::to_string(static_cast<int64_t>(value)) + ",";
+      }
+    }
+
+    return description;
+  }
+
+  ModelCache::ModelCache(std::string directory, size_t maxBytes) : directory_(std::move(directory)), maxBytes_(maxBytes)
+  {
+    // Accept file:// URIs as returned by the asset helpers
+    if (directory_.rfind("file://", 0) == 0)
+    {
+      directory_ = directory_.substr(7);
+    }
+
+    std::error_code error;
+    fs::create_directories(directory_, error);
+    if (error)
+    {
+      throw std::runtime_error("Failed to create model cache directory " + directory_ + ": " + error.message());
+    }
+  }
+
+  bool ModelCache::isSupported(const std::optional<SessionOptions> &options)
+  {
+    if (!options.has_value() || !options->executionProviders.has_value())
+      return true;
+
+    // Models partitioned onto compiling providers (CoreML, NNAPI, ...) can't be saved
+    return std::all_of(options->executionProviders->begin(), options->executionProviders->end(),
+                       [](const auto &provider)
+                       {
+                         std::string name = std::holds_alternative<std::string>(provider)
+                                                ? std::get<std::string>(provider)
+                                                : std::get<ProviderOptions>(provider).name;
+                         return name == "cpu";
+                       });
+  }
+
+  std::string ModelCache::makeKey(uint64_t sourceHash, uint64_t revisionHash, const std::optional<SessionOptions> &options) const
+  {
+    std::string description = describeSessionOptions(options);
+    uint64_t optionsHash = hashBytes(description.data(), description.size());
+    // The optimized graph also depends on the ONNX Runtime it was produced by
+    std::string version = Ort::GetVersionString();
+    revisionHash = hashBytes(version.data(), version.size(), revisionHash);
+
+    char key[50];
+    std::snprintf(key, sizeof(key), "%016llx%016llx%016llx",
+                  static_cast<unsigned long long>(sourceHash),
+                  static_cast<unsigned long long>(revisionHash),
+                  static_cast<unsigned long long>(optionsHash));
+    return key;
+  }
+
+  std::string ModelCache::keyForFile(const std::string &modelPath, const std::optional<SessionOptions> &options) const
+  {
+    // Hashing the file identity instead of its contents keeps lookups cheap for large models,
+    // any rewrite of the model file changes its size or modification time
+    auto size = fs::file_size(modelPath);
+    auto modified = fs::last_write_time(modelPath).time_since_epoch().count();
+
+    uint64_t revision = hashBytes(&size, sizeof(size));
+    revision = hashBytes(&modified, sizeof(modified), revision);
+    return makeKey(hashBytes(modelPath.data(), modelPath.size()), revision, options);
+  }
+
+  std::string ModelCache::keyForBuffer(uint64_t contentHash, const std::optional<SessionOptions> &options) const
+  {
+    // Buffers have no identity besides their contents, older revisions are left to the size limit
+    return makeKey(contentHash, 0, options);
+  }
+
+  std::string ModelCache::getPath(const std::string &key) const
+  {
+    return (fs::path(directory_) / (key + ".ort")).string();
+  }
+
+  std::string ModelCache::getTemporaryPath(const std::string &key) const
+  {
+    // The process id keeps apps sharing a cache directory apart, the counter concurrent loads
+    static std::atomic<uint64_t> counter{0};
+    return getPath(key) + "." + std::to_string(getpid()) + "-" + std::to_string(counter++) + ".tmp";
+  }
+
+  std::optional<std::string> ModelCache::find(const std::string &key) const
+  {
+    std::string path = getPath(key);
+    std::error_code error;
+    if (fs::exists(path, error) && fs::file_size(path, error) > 0)
+    {
+      // The modification time doubles as the last use for prune()
+      fs::last_write_time(path, fs::file_time_type::clock::now(), error);
+      return path;
+    }
+    return std::nullopt;
+  }
+
+  void ModelCache::commit(const std::string &key, const std::string &temporaryPath) const
+  {
+    // Renaming is atomic, so an interrupted write never leaves a truncated entry behind.
+    // Concurrent loads of the same model each rename a complete file, the last one wins.
+    std::error_code error;
+    fs::rename(temporaryPath, getPath(key), error);
+    if (error)
+    {
+      discard(temporaryPath);
+      return;
+    }
+    prune(key);
+  }
+
+  void ModelCache::discard(const std::string &temporaryPath) const
+  {
+    std::error_code error;
+    fs::remove(temporaryPath, error);
+  }
+
+  void ModelCache::prune(const std::string &key) const
+  {
+    struct Entry
+    {
+      fs::path path;
+      uintmax_t size;
+      fs::file_time_type lastUsed;
+    };
+
+    // Key layout, see makeKey()
+    std::string source = key.substr(0, 16);
+    std::string options = key.substr(32);
+
+    std::error_code error;
+    std::vector<Entry> entries;
+    uintmax_t totalSize = 0;
+    for (const auto &file : fs::directory_iterator(directory_, error))
+    {
+      const fs::path &path = file.path();
+      // Temporary files a day old were left behind by a load that never finished
+      if (path.extension() == ".tmp")
+      {
+        auto modified = fs::last_write_time(path, error);
+        if (!error && fs::file_time_type::clock::now() - modified > std::chrono::hours(24))
+          fs::remove(path, error);
+        continue;
+      }
+
+      std::string name = path.stem().string();
+      if (path.extension() != ".ort" || name.size() != key.size() || name == key)
+        continue;
+
+      // An older revision of the same model with the same options is never going to be used again
+      if (name.compare(0, 16, source) == 0 && name.compare(32, std::string::npos, options) == 0)
+      {
+        fs::remove(path, error);
+        continue;
+      }
+
+      uintmax_t size = fs::file_size(path, error);
+      if (error)
+        continue;
+      entries.push_back({path, size, fs::last_write_time(path, error)});
+      totalSize += size;
+    }
+
+    uintmax_t keptSize = fs::file_size(getPath(key), error);
+    if (error || totalSize + keptSize <= maxBytes_)
+      return;
+
+    // Least recently used first, the entry just written is always kept
+    std::sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+              { return a.lastUsed < b.lastUsed; });
+    for (const auto &entry : entries)
+    {
+      if (totalSize + keptSize <= maxBytes_)
+        break;
+      if (fs::remove(entry.path, error))
+        totalSize -= entry.size;
+    }
+  }
+
+  void ModelCache::remove(const std::string &key) const
+  {
+    std::error_code error;
+    fs::remove(getPath(key), error);
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
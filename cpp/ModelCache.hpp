@@ -0,0 +1,64 @@
+#pragma once
+
+#include "SessionOptions.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // On-disk cache of optimized ORT-format models.
+  // Entries are keyed by model identity, ONNX Runtime version and the session options that
+  // influence graph optimization, so a cached model is only reused when it would come out identical.
+  // Committing an entry removes older revisions of the same model and trims the least recently
+  // used entries down to the size limit.
+  class ModelCache
+  {
+  public:
+    static constexpr size_t DEFAULT_MAX_BYTES = 512 * 1024 * 1024;
+
+    explicit ModelCache(std::string directory, size_t maxBytes = DEFAULT_MAX_BYTES);
+
+    // Whether the options allow caching, compiling execution providers can't be serialized
+    static bool isSupported(const std::optional<SessionOptions> &options);
+
+    // Cache key for a model file, based on its path, size and modification time
+    std::string keyForFile(const std::string &modelPath, const std::optional<SessionOptions> &options) const;
+    // Cache key for an in-memory model, `contentHash` comes from hashModel()
+    std::string keyForBuffer(uint64_t contentHash, const std::optional<SessionOptions> &options) const;
+
+    // Path of the optimized model for `key`, if it has been cached. Marks the entry as recently used.
+    std::optional<std::string> find(const std::string &key) const;
+    // Path ONNX Runtime should write the optimized model to before it is committed, unique per call
+    // so that concurrent first loads of the same model don't write to the same file
+    std::string getTemporaryPath(const std::string &key) const;
+    // Moves a fully written temporary file into the cache
+    void commit(const std::string &key, const std::string &temporaryPath) const;
+    // Deletes a temporary file whose load failed
+    void discard(const std::string &temporaryPath) const;
+    // Removes the entry for `key`, e.g. after it failed to load
+    void remove(const std::string &key) const;
+
+  private:
+    std::string directory_;
+    size_t maxBytes_;
+
+    std::string getPath(const std::string &key) const;
+    // Keys are <source><revision><options>, so that entries superseded by a new revision of the
+    // same model (an app update, a rewritten file, a new ONNX Runtime) can be recognized
+    std::string makeKey(uint64_t sourceHash, uint64_t revisionHash, const std::optional<SessionOptions> &options) const;
+    // Removes stale revisions of `key`'s model and the least recently used entries over maxBytes_
+    void prune(const std::string &key) const;
+  };
+
+  // 64-bit FNV-1a hash, for keys and other short inputs
+  uint64_t hashBytes(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL);
+  // 64-bit hash of a whole model and its size, fast enough to run over hundreds of megabytes
+  uint64_t hashModel(const void *data, size_t size);
+
+  // Canonical description of the options that affect the optimized graph
+  std::string describeSessionOptions(const std::optional<SessionOptions> &options);
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,215 @@
+#include "ModelInitializers.hpp"
+#include <stdexcept>
+#include <tuple>
+#include <utility>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    // Field numbers of onnx.proto
+    constexpr uint32_t MODEL_GRAPH = 7;
+    constexpr uint32_t GRAPH_INITIALIZER = 5;
+    constexpr uint32_t TENSOR_DIMS = 1;
+    constexpr uint32_t TENSOR_DATA_TYPE = 2;
+    constexpr uint32_t TENSOR_NAME = 8;
+    constexpr uint32_t TENSOR_RAW_DATA = 9;
+    constexpr uint32_t TENSOR_DATA_LOCATION = 14;
+    constexpr uint64_t DATA_LOCATION_EXTERNAL = 1;
+
+    enum WireType : uint32_t
+    {
+      VARINT = 0,
+      FIXED64 = 1,
+      LENGTH_DELIMITED = 2,
+      FIXED32 = 5
+    };
+
+    // Reads one protobuf message field by field
+    class Reader
+    {
+    public:
+      Reader(const uint8_t *data, size_t size) : position_(data), end_(data + size) {}
+
+      bool done() const { return position_ == end_; }
+
+      uint64_t readVarint()
+      {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+          if (position_ == end_)
+            throw std::runtime_error("Malformed ONNX model: truncated varint");
+          uint8_t byte = *position_++;
+          value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+          if ((byte & 0x80) == 0)
+            return value;
+        }
+        throw std::runtime_error("Malformed ONNX model: varint is too long");
+      }
+
+      // Field number and wire type of the next field
+      std::pair<uint32_t, uint32_t> readTag()
+      {
+        uint64_t tag = readVarint();
+        return {static_cast<uint32_t>(tag >> 3), static_cast<uint32_t>(tag & 7)};
+      }
+
+      std::pair<const uint8_t *, size_t> readBytes()
+      {
+        uint64_t length = readVarint();
+        if (length > static_cast<uint64_t>(end_ - position_))
+          throw std::runtime_error("Malformed ONNX model: field runs past the end");
+        const uint8_t *start = position_;
+        position_ += length;
+        return {start, static_cast<size_t>(length)};
+      }
+
+      void skip(uint32_t wireType)
+      {
+        switch (wireType)
+        {
+        case VARINT:
+          readVarint();
+          return;
+        case FIXED64:
+          advance(8);
+          return;
+        case LENGTH_DELIMITED:
+          readBytes();
+          return;
+        case FIXED32:
+          advance(4);
+          return;
+        }
+        throw std::runtime_error("Malformed ONNX model: unsupported wire type " + std::to_string(wireType));
+      }
+
+    private:
+      const uint8_t *position_;
+      const uint8_t *end_;
+
+      void advance(size_t bytes)
+      {
+        if (bytes > static_cast<size_t>(end_ - position_))
+          throw std::runtime_error("Malformed ONNX model: field runs past the end");
+        position_ += bytes;
+      }
+    };
+
+    // Bytes per element of the fixed size types, 0 for the others (strings, complex, 4-bit)
+    size_t elementSize(int32_t dataType)
+    {
+      switch (dataType)
+      {
+      case 2:  // UINT8
+      case 3:  // INT8
+      case 9:  // BOOL
+        return 1;
+      case 4:  // UINT16
+      case 5:  // INT16
+      case 10: // FLOAT16
+      case 16: // BFLOAT16
+        return 2;
+      case 1:  // FLOAT
+      case 6:  // INT32
+      case 12: // UINT32
+        return 4;
+      case 7:  // INT64
+      case 11: // DOUBLE
+      case 13: // UINT64
+        return 8;
+      default:
+        return 0;
+      }
+    }
+
+    // Reads a TensorProto, false if its values aren't stored inline in raw_data
+    bool readTensor(const uint8_t *data, size_t size, InlineInitializer &tensor)
+    {
+      Reader reader(data, size);
+      bool hasRawData = false;
+      bool external = false;
+      while (!reader.done())
+      {
+        auto [field, wireType] = reader.readTag();
+        if (field == TENSOR_DIMS && wireType == VARINT)
+        {
+          tensor.dims.push_back(static_cast<int64_t>(reader.readVarint()));
+        }
+        else if (field == TENSOR_DIMS && wireType == LENGTH_DELIMITED)
+        {
+          auto [packed, length] = reader.readBytes();
+          Reader dims(packed, length);
+          while (!dims.done())
+            tensor.dims.push_back(static_cast<int64_t>(dims.readVarint()));
+        }
+        else if (field == TENSOR_DATA_TYPE && wireType == VARINT)
+        {
+          tensor.dataType = static_cast<int32_t>(reader.readVarint());
+        }
+        else if (field == TENSOR_NAME && wireType == LENGTH_DELIMITED)
+        {
+          auto [name, length] = reader.readBytes();
+          tensor.name.assign(reinterpret_cast<const char *>(name), length);
+        }
+        else if (field == TENSOR_RAW_DATA && wireType == LENGTH_DELIMITED)
+        {
+          std::tie(tensor.data, tensor.byteSize) = reader.readBytes();
+          hasRawData = true;
+        }
+        else if (field == TENSOR_DATA_LOCATION && wireType == VARINT)
+        {
+          external = reader.readVarint() == DATA_LOCATION_EXTERNAL;
+        }
+        else
+        {
+          reader.skip(wireType);
+        }
+      }
+      return hasRawData && !external && !tensor.name.empty();
+    }
+  } // namespace
+
+  std::vector<InlineInitializer> readInlineInitializers(const uint8_t *model, size_t size, size_t minByteSize)
+  {
+    std::vector<InlineInitializer> initializers;
+    Reader modelReader(model, size);
+    while (!modelReader.done())
+    {
+      auto [field, wireType] = modelReader.readTag();
+      if (field != MODEL_GRAPH || wireType != LENGTH_DELIMITED)
+      {
+        modelReader.skip(wireType);
+        continue;
+      }
+
+      auto [graph, graphSize] = modelReader.readBytes();
+      Reader graphReader(graph, graphSize);
+      while (!graphReader.done())
+      {
+        auto [graphField, graphWireType] = graphReader.readTag();
+        if (graphField != GRAPH_INITIALIZER || graphWireType != LENGTH_DELIMITED)
+        {
+          graphReader.skip(graphWireType);
+          continue;
+        }
+
+        auto [tensorData, tensorSize] = graphReader.readBytes();
+        InlineInitializer tensor;
+        if (!readTensor(tensorData, tensorSize, tensor) || tensor.byteSize < minByteSize)
+          continue;
+        // Values that don't match their shape are left for ONNX Runtime to report
+        size_t expected = elementSize(tensor.dataType);
+        for (int64_t dim : tensor.dims)
+          expected = dim >= 0 ? expected * static_cast<size_t>(dim) : 0;
+        if (expected == 0 || expected != tensor.byteSize)
+          continue;
+        initializers.push_back(std::move(tensor));
+      }
+    }
+    return initializers;
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // An initializer stored inline in an ONNX model, pointing into the serialized model
+  struct InlineInitializer
+  {
+    std::string name;
+    int32_t dataType = 0; // TensorProto.DataType, the same values as ONNXTensorElementDataType
+    std::vector<int64_t> dims;
+    const uint8_t *data = nullptr;
+    size_t byteSize = 0;
+  };
+
+  // Reads the initializers of the main graph of a serialized ONNX-format model (ModelProto) that
+  // keep their values in raw_data, without a protobuf dependency. Initializers stored in typed
+  // fields or external data, of types without a fixed element size or smaller than `minByteSize`
+  // are skipped. Throws on malformed models.
+  std::vector<InlineInitializer> readInlineInitializers(const uint8_t *model, size_t size, size_t minByteSize = 0);
+
+} // namespace margelo::nitro::nitroonnxruntime
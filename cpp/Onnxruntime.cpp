@@ -8,18 +8,72 @@
 // Include NNAPI provider factory for Android
 #if defined(__ANDROID__)
 #include <nnapi_provider_factory.h>
-#include <android/asset_manager.h>
-#include <android/asset_manager_jni.h>
 #endif
 
 namespace margelo::nitro::nitroonnxruntime
 {
 
+  namespace
+  {
+    // model.onnx -> model.int8.onnx
+    std::string withVariantSuffix(const std::string &path, const std::string &variant)
+    {
+      size_t slash = path.find_last_of('/');
+      size_t dot = path.find_last_of('.');
+      if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        return path + "." + variant;
+      return path.substr(0, dot) + "." + variant + path.substr(dot);
+    }
+  } // namespace
+
   std::string Onnxruntime::getVersion()
   {
     return Ort::GetVersionString();
   }
 
+  Ort::Env &Onnxruntime::getEnv()
+  {
+    std::lock_guard<std::mutex> lock(envMutex_);
+    if (env_ != nullptr)
+      return env_;
+
+    if (!threadPoolOptions_.has_value())
+    {
+      env_ = Ort::Env(ORT_LOGGING_LEVEL_WARNING, "Onnxruntime");
+      return env_;
+    }
+
+    Ort::ThreadingOptions threadingOptions;
+    const auto &options = threadPoolOptions_.value();
+    if (options.intraOpNumThreads.has_value())
+      threadingOptions.SetGlobalIntraOpNumThreads(static_cast<int>(options.intraOpNumThreads.value()));
+    if (options.interOpNumThreads.has_value())
+      threadingOptions.SetGlobalInterOpNumThreads(static_cast<int>(options.interOpNumThreads.value()));
+    if (options.allowSpinning.has_value())
+      threadingOptions.SetGlobalSpinControl(options.allowSpinning.value() ? 1 : 0);
+    if (options.intraOpThreadAffinities.has_value())
+      // Only exposed through the C API, Ort::ThreadingOptions has no wrapper for it
+      Ort::ThrowOnError(Ort::GetApi().SetGlobalIntraOpThreadAffinity(threadingOptions,
+                                                                     options.intraOpThreadAffinities->c_str()));
+
+    env_ = Ort::Env(threadingOptions, ORT_LOGGING_LEVEL_WARNING, "Onnxruntime");
+    return env_;
+  }
+
+  void Onnxruntime::configureThreadPools(const ThreadPoolOptions &options)
+  {
+    if (options.intraOpNumThreads.has_value() && options.intraOpNumThreads.value() < 0)
+      throw std::runtime_error("intraOpNumThreads must not be negative");
+    if (options.interOpNumThreads.has_value() && options.interOpNumThreads.value() < 0)
+      throw std::runtime_error("interOpNumThreads must not be negative");
+
+    std::lock_guard<std::mutex> lock(envMutex_);
+    // The thread pools belong to the environment, which can't be recreated under loaded sessions
+    if (env_ != nullptr)
+      throw std::runtime_error("configureThreadPools() must be called before the first model is loaded");
+    threadPoolOptions_ = options;
+  }
+
   void Onnxruntime::configureSessionOptions(Ort::SessionOptions &sessionOptions, const std::optional<SessionOptions> &options)
   {
     if (!options.has_value())
@@ -85,6 +139,21 @@ namespace margelo::nitro::nitroonnxruntime
       sessionOptions.SetExecutionMode(execMode);
     }
 
+    // Pin symbolic dimensions (e.g. batch or sequence length) to fixed values
+    if (options->freeDimensionOverrides.has_value())
+    {
+      for (const auto &[dimensionName, value] : options->freeDimensionOverrides.value())
+      {
+        sessionOptions.AddFreeDimensionOverrideByName(dimensionName.c_str(), static_cast<int64_t>(value));
+      }
+    }
+
+    // Write the optimized graph to disk so it can be loaded directly next time
+    if (options->optimizedModelFilePath.has_value())
+    {
+      sessionOptions.SetOptimizedModelFilePath(options->optimizedModelFilePath.value().c_str());
+    }
+
     // Set logging ID and severity level
     if (options->logId.has_value())
     {
@@ -97,6 +166,36 @@ namespace margelo::nitro::nitroonnxruntime
       sessionOptions.SetLogSeverityLevel(severity);
     }
 
+    // Prepacking keeps a second, reordered copy of MatMul/Gemm weights, skipping it trades some
+    // speed for a smaller resident set
+    if (options->disablePrepacking.value_or(false))
+    {
+      sessionOptions.AddConfigEntry("session.disable_prepacking", "1");
+    }
+
+    if (options->enableProfiling.value_or(false))
+    {
+      // A relative prefix would land in the process' working directory, which apps can't write to
+      if (!options->profileFilePrefix.has_value() || options->profileFilePrefix->empty())
+        throw std::runtime_error("enableProfiling needs a profileFilePrefix in a writable directory, e.g. the app's cache directory");
+      std::string prefix = options->profileFilePrefix.value();
+      if (prefix.rfind("file://", 0) == 0)
+        prefix = prefix.substr(7);
+      sessionOptions.EnableProfiling(prefix.c_str());
+    }
+
+    // Use the environment's thread pools instead of creating threads for this session,
+    // the session's own thread counts are ignored then
+    if (options->useGlobalThreadPools.value_or(false))
+    {
+      {
+        std::lock_guard<std::mutex> lock(envMutex_);
+        if (!threadPoolOptions_.has_value())
+          throw std::runtime_error("useGlobalThreadPools requires configureThreadPools() to be called first");
+      }
+      sessionOptions.DisablePerSessionThreads();
+    }
+
     // Set execution providers if specified
     if (options->executionProviders.has_value())
     {
@@ -190,27 +289,328 @@ namespace margelo::nitro::nitroonnxruntime
     }
   }
 
-  std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> Onnxruntime::loadModel(const std::string &modelPath, const std::optional<SessionOptions> &options)
+  void Onnxruntime::resolveWeightsVariant(ModelSource &source, const std::optional<SessionOptions> &options)
   {
-    auto promise = Promise<std::shared_ptr<HybridInferenceSessionSpec>>::create();
+    if (!options.has_value() || !options->weightsVariant.has_value())
+      return;
+
+    const std::string &variant = options->weightsVariant.value();
+    if (variant.empty() || variant.find('/') != std::string::npos)
+      throw std::runtime_error("Invalid weightsVariant: " + variant);
+    if (source.buffer)
+      throw std::runtime_error("weightsVariant requires a model path or asset, load the variant's buffer directly instead");
+
+    bool isAsset = !source.assetPath.empty();
+    std::string &modelPath = isAsset ? source.assetPath : source.path;
+    std::string variantPath = withVariantSuffix(modelPath, variant);
+    bool exists = isAsset ? MappedModel::assetSize(variantPath).has_value() : MappedModel::fileSize(variantPath).has_value();
+    if (!exists)
+    {
+      // Nothing is quantized on the device, a missing variant only loads the original model when asked to
+      if (!options->weightsVariantFallback.value_or(false))
+        throw std::runtime_error("No " + variant + " weights at " + variantPath + ", quantize the model offline or set weightsVariantFallback");
+      Logger::log(LogLevel::Warning, "Onnxruntime", "No %s weights at %s, loading the original model",
+                  variant.c_str(), variantPath.c_str());
+      return;
+    }
+
+    modelPath = variantPath;
+    source.weightsVariant = variant;
+  }
+
+  std::shared_ptr<SharedWeights> Onnxruntime::getSharedWeights(const std::string &path)
+  {
+    std::lock_guard<std::mutex> lock(sharedWeightsMutex_);
+    if (auto weights = sharedWeights_[path].lock())
+      return weights;
+
+    // Forget weights whose sessions are all gone since
+    for (auto it = sharedWeights_.begin(); it != sharedWeights_.end();)
+    {
+      if (it->second.expired())
+        it = sharedWeights_.erase(it);
+      else
+        ++it;
+    }
+    // The mapping is only read while the weights are copied out of it
+    auto mapping = MappedModel::mapFile(path);
+    auto weights = std::make_shared<SharedWeights>(static_cast<const uint8_t *>(mapping->data()), mapping->size());
+    Logger::log(LogLevel::Info, "Onnxruntime", "Sharing %zu bytes of weights between the sessions of %s",
+                weights->byteSize(), path.c_str());
+    sharedWeights_[path] = weights;
+    return weights;
+  }
+
+  std::shared_ptr<MappedModel> Onnxruntime::mapShared(const std::string &key, const std::function<std::shared_ptr<MappedModel>()> &map)
+  {
+    std::lock_guard<std::mutex> lock(sharedWeightsMutex_);
+    if (auto mapping = mappings_[key].lock())
+      return mapping;
+
+    // Forget mappings that have been unmapped since
+    for (auto it = mappings_.begin(); it != mappings_.end();)
+    {
+      if (it->second.expired())
+        it = mappings_.erase(it);
+      else
+        ++it;
+    }
+    auto mapping = map();
+    mappings_[key] = mapping;
+    return mapping;
+  }
+
+  std::shared_ptr<Ort::Session> Onnxruntime::openSession(const ModelSource &source, Ort::SessionOptions &sessionOptions,
+                                                         const std::shared_ptr<SharedWeights> &weights)
+  {
+    // Shared initializers replace the session's own copy, and ONNX Runtime only shares packed
+    // weights through a container for initializers added this way
+    OrtPrepackedWeightsContainer *prepackedWeights = nullptr;
+    if (weights && !weights->empty())
+    {
+      weights->addTo(sessionOptions);
+      prepackedWeights = weights->prepackedWeights();
+    }
+    std::shared_ptr<MappedModel> mapping;
+    Ort::Session *session;
+    if (source.mapping && !source.mapping->isOrtFormat())
+    {
+      // ONNX Runtime parses ONNX-format models into its own graph, the mapping is only read once
+      session = new Ort::Session(getEnv(), source.mapping->data(), source.mapping->size(), sessionOptions, prepackedWeights);
+    }
+    else if (source.mapping)
+    {
+      // ORT-format models are used in place, initializers included, so the weights are never copied.
+      // The mapping has to stay alive for as long as the session does.
+      mapping = source.mapping;
+      sessionOptions.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+      sessionOptions.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+      session = new Ort::Session(getEnv(), mapping->data(), mapping->size(), sessionOptions, prepackedWeights);
+    }
+    else if (source.buffer)
+    {
+      session = new Ort::Session(getEnv(), source.buffer->data(), source.buffer->size(), sessionOptions, prepackedWeights);
+    }
+    else
+    {
+      session = new Ort::Session(getEnv(), source.path.c_str(), sessionOptions, prepackedWeights);
+    }
+    return std::shared_ptr<Ort::Session>(session, [mapping, weights](Ort::Session *ownedSession)
+                                         { delete ownedSession; });
+  }
+
+  std::shared_ptr<Ort::Session> Onnxruntime::createSession(const ModelSource &modelSource, const std::optional<SessionOptions> &options)
+  {
+    ModelSource source = modelSource;
+    if (!source.assetPath.empty())
+    {
+      source.mapping = mapShared("asset:" + source.assetPath, [&]()
+                                 { return MappedModel::mapAsset(source.assetPath); });
+    }
+    else if (!source.path.empty() && MappedModel::isOrtFormatFile(source.path))
+    {
+      // ONNX-format files keep loading by path, so that external data next to them still resolves
+      source.mapping = mapShared("file:" + source.path, [&]()
+                                 { return MappedModel::mapFile(source.path); });
+    }
+
+    Ort::SessionOptions sessionOptions;
+    configureSessionOptions(sessionOptions, options);
+
+    // An explicit optimizedModelFilePath takes precedence over the managed cache
+    bool useCache = options.has_value() && options->modelCacheDirectory.has_value() &&
+                    !options->optimizedModelFilePath.has_value() && ModelCache::isSupported(options);
+    if (!useCache)
+    {
+      // ORT-format models already share their initializers through the mapping
+      std::shared_ptr<SharedWeights> weights;
+      if (source.shareWeights && !source.path.empty() && !source.mapping)
+        weights = getSharedWeights(source.path);
+      return openSession(source, sessionOptions, weights);
+    }
+
+    size_t maxCacheBytes = ModelCache::DEFAULT_MAX_BYTES;
+    if (options->modelCacheMaxBytes.has_value())
+    {
+      if (options->modelCacheMaxBytes.value() < 0)
+        throw std::runtime_error("modelCacheMaxBytes must not be negative");
+      maxCacheBytes = static_cast<size_t>(options->modelCacheMaxBytes.value());
+    }
+    ModelCache cache(options->modelCacheDirectory.value(), maxCacheBytes);
+    std::string key;
+    if (source.buffer)
+      key = cache.keyForBuffer(source.contentHash, options);
+    else if (!source.path.empty())
+      key = cache.keyForFile(source.path, options);
+    else
+      key = cache.keyForBuffer(hashModel(source.mapping->data(), source.mapping->size()), options);
+
+    if (auto cachedPath = cache.find(key))
+    {
+      try
+      {
+        // The cached model has already been optimized, load it as-is
+        Ort::SessionOptions cachedOptions;
+        configureSessionOptions(cachedOptions, options);
+        cachedOptions.AddConfigEntry("session.load_model_format", "ORT");
+        cachedOptions.SetGraphOptimizationLevel(ORT_DISABLE_ALL);
+        auto mapping = mapShared("file:" + cachedPath.value(), [&]()
+                                 { return MappedModel::mapFile(cachedPath.value()); });
+        return openSession(ModelSource{"", nullptr, "", mapping}, cachedOptions);
+      }
+      catch (const std::exception &e)
+      {
+        Logger::log(LogLevel::Warning, "Onnxruntime", "Discarding unreadable cached model: %s", e.what());
+        cache.remove(key);
+      }
+    }
+
+    // Cache miss, let ONNX Runtime serialize the optimized graph while loading
+    std::string temporaryPath = cache.getTemporaryPath(key);
+    sessionOptions.SetOptimizedModelFilePath(temporaryPath.c_str());
+    sessionOptions.AddConfigEntry("session.save_model_format", "ORT");
+    std::shared_ptr<Ort::Session> session;
     try
     {
-      Ort::SessionOptions sessionOptions;
-      configureSessionOptions(sessionOptions, options);
+      session = openSession(source, sessionOptions);
+    }
+    catch (...)
+    {
+      cache.discard(temporaryPath);
+      throw;
+    }
+    cache.commit(key, temporaryPath);
+    return session;
+  }
 
-      auto session = std::make_unique<Ort::Session>(env_, modelPath.c_str(), sessionOptions);
-      auto inferenceSession = std::make_shared<InferenceSession>(std::move(session));
-      promise->resolve(inferenceSession);
+  void Onnxruntime::configureWorkerPool(const WorkerPoolOptions &options)
+  {
+    size_t numThreads = WorkerPool::DEFAULT_NUM_THREADS;
+    if (options.numThreads.has_value())
+    {
+      if (options.numThreads.value() < 1)
+        throw std::runtime_error("numThreads must be at least 1");
+      numThreads = static_cast<size_t>(options.numThreads.value());
     }
-    catch (const Ort::Exception &e)
+
+    size_t maxQueueSize = WorkerPool::DEFAULT_MAX_QUEUE_SIZE;
+    if (options.maxQueueSize.has_value())
     {
-      Logger::log(LogLevel::Error, "Onnxruntime", e.what());
-      promise->reject(std::make_exception_ptr(e));
+      if (options.maxQueueSize.value() < 1)
+        throw std::runtime_error("maxQueueSize must be at least 1");
+      maxQueueSize = static_cast<size_t>(options.maxQueueSize.value());
+    }
+
+    // Sessions keep a reference to the pool they were created with, so they
+    // finish their queued work there while new sessions use the new pool
+    workerPool_ = std::make_shared<WorkerPool>(numThreads, maxQueueSize);
+  }
+
+  void Onnxruntime::setMemoryBudget(double bytes)
+  {
+    if (bytes < 0)
+      throw std::runtime_error("The memory budget must not be negative");
+    MemoryManager::shared().setBudget(static_cast<size_t>(bytes));
+  }
+
+  void Onnxruntime::trimMemory(bool critical)
+  {
+    MemoryManager::shared().handlePressure(critical ? MemoryManager::Pressure::Critical : MemoryManager::Pressure::Moderate);
+  }
+
+  std::shared_ptr<InferenceSession> Onnxruntime::loadSession(const ModelSource &source, const std::string &registryKey,
+                                                             const std::optional<SessionOptions> &options,
+                                                             const std::shared_ptr<WorkerPool> &workerPool,
+                                                             std::shared_ptr<const void> evictionGroup)
+  {
+    // Profiling belongs to the Ort::Session, so every profiled load gets one of its own
+    std::string key = registryKey;
+    if (options.has_value() && options->enableProfiling.value_or(false))
+      key += "|profiling:" + std::to_string(nextProfilingId_++);
+
+    // Only a load that actually creates the session grows the resident set
+    bool created = false;
+    size_t residentBefore = InferenceSession::residentMemoryBytes();
+    auto session = registry_->acquire(key, [&]()
+                                      {
+                                        created = true;
+                                        return createSession(source, options); });
+
+    LoadFootprint footprint;
+    if (created)
+    {
+      size_t residentAfter = InferenceSession::residentMemoryBytes();
+      footprint.residentBytes = residentAfter > residentBefore ? residentAfter - residentBefore : 0;
+    }
+    if (source.buffer)
+      footprint.modelBytes = source.buffer->size();
+    else if (!source.assetPath.empty())
+      footprint.modelBytes = MappedModel::assetSize(source.assetPath).value_or(0);
+    else
+      footprint.modelBytes = MappedModel::fileSize(source.path).value_or(0);
+    footprint.weightsVariant = source.weightsVariant;
+
+    // The registry may outlive this instance's sessions or the other way around
+    std::weak_ptr<SessionRegistry> registry = registry_;
+    auto release = [registry, key]()
+    {
+      if (auto strongRegistry = registry.lock())
+        strongRegistry->release(key);
+    };
+
+    std::shared_ptr<InferenceSession> inferenceSession;
+    try
+    {
+      inferenceSession = std::make_shared<InferenceSession>(std::move(session), workerPool, release, std::move(footprint));
+    }
+    catch (...)
+    {
+      release();
+      throw;
+    }
+
+    // Evicted sessions come back through the registry, joining any other holder of the same model
+    auto self = std::dynamic_pointer_cast<Onnxruntime>(shared_from_this());
+    inferenceSession->setReloader([self, source, key, options]()
+                                  { return self->registry_->acquire(key, [&]()
+                                                                    { return self->createSession(source, options); }); });
+    // Without an arena there is nothing to shrink, and ONNX Runtime rejects the shrink request
+    inferenceSession->setArenaEnabled(!options.has_value() || options->enableCpuMemArena.value_or(true));
+    inferenceSession->setProfiling(options.has_value() && options->enableProfiling.value_or(false));
+    inferenceSession->setEvictionGroup(std::move(evictionGroup));
+    auto &memoryManager = MemoryManager::shared();
+    memoryManager.track(inferenceSession);
+    memoryManager.enforceBudget(inferenceSession.get());
+    return inferenceSession;
+  }
+
+  std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> Onnxruntime::loadModel(const std::string &modelPath, const std::optional<SessionOptions> &options)
+  {
+    auto promise = Promise<std::shared_ptr<HybridInferenceSessionSpec>>::create();
+    try
+    {
+      auto self = std::dynamic_pointer_cast<Onnxruntime>(shared_from_this());
+      auto workerPool = workerPool_;
+      workerPool->submit([self, workerPool, promise, modelPath, options]()
+                         {
+        try
+        {
+          // Accept file:// URIs so that downloaded or bundled models are loaded in place
+          ModelSource source{modelPath.rfind("file://", 0) == 0 ? modelPath.substr(7) : modelPath};
+          resolveWeightsVariant(source, options);
+          std::string key = SessionRegistry::keyForFile(source.path, options);
+          promise->resolve(self->loadSession(source, key, options, workerPool));
+        }
+        catch (const std::exception &e)
+        {
+          Logger::log(LogLevel::Error, "Onnxruntime", e.what());
+          promise->reject(std::current_exception());
+        } });
     }
     catch (const std::exception &e)
     {
       Logger::log(LogLevel::Error, "Onnxruntime", e.what());
-      promise->reject(std::make_exception_ptr(e));
+      promise->reject(std::current_exception());
     }
     return promise;
   }
@@ -225,24 +625,130 @@ namespace margelo::nitro::nitroonnxruntime
         throw std::runtime_error("Invalid or empty buffer provided for model loading");
       }
 
-      Ort::SessionOptions sessionOptions;
-      configureSessionOptions(sessionOptions, options);
+      // The JS buffer can't be read from the worker thread, take a native copy of the model first
+      std::shared_ptr<ArrayBuffer> modelBuffer = buffer;
+      if (!buffer->isOwner())
+      {
+        size_t size = buffer->size();
+        uint8_t *data = new uint8_t[size];
+        std::memcpy(data, buffer->data(), size);
+        modelBuffer = std::make_shared<margelo::nitro::NativeArrayBuffer>(
+            data,
+            size,
+            [data]()
+            {
+              delete[] data;
+            });
+      }
 
-      const void *model_data = buffer->data();
-      size_t model_size = buffer->size();
-      auto session = std::make_unique<Ort::Session>(env_, model_data, model_size, sessionOptions);
-      auto inferenceSession = std::make_shared<InferenceSession>(std::move(session));
-      promise->resolve(inferenceSession);
+      auto self = std::dynamic_pointer_cast<Onnxruntime>(shared_from_this());
+      auto workerPool = workerPool_;
+      workerPool->submit([self, workerPool, promise, modelBuffer, options]()
+                         {
+        try
+        {
+          ModelSource source{"", modelBuffer};
+          resolveWeightsVariant(source, options);
+          source.contentHash = hashModel(modelBuffer->data(), modelBuffer->size());
+          std::string key = SessionRegistry::keyForBuffer(source.contentHash, modelBuffer->size(), options);
+          promise->resolve(self->loadSession(source, key, options, workerPool));
+        }
+        catch (const std::exception &e)
+        {
+          Logger::log(LogLevel::Error, "Onnxruntime", e.what());
+          promise->reject(std::current_exception());
+        } });
     }
-    catch (const Ort::Exception &e)
+    catch (const std::exception &e)
     {
       Logger::log(LogLevel::Error, "Onnxruntime", e.what());
-      promise->reject(std::make_exception_ptr(e));
+      promise->reject(std::current_exception());
+    }
+    return promise;
+  }
+
+  std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> Onnxruntime::loadModelFromAsset(const std::string &assetPath, const std::optional<SessionOptions> &options)
+  {
+    auto promise = Promise<std::shared_ptr<HybridInferenceSessionSpec>>::create();
+    try
+    {
+      auto self = std::dynamic_pointer_cast<Onnxruntime>(shared_from_this());
+      auto workerPool = workerPool_;
+      workerPool->submit([self, workerPool, promise, assetPath, options]()
+                         {
+        try
+        {
+          ModelSource source{"", nullptr, assetPath};
+          resolveWeightsVariant(source, options);
+          std::string key = SessionRegistry::keyForAsset(source.assetPath, options);
+          promise->resolve(self->loadSession(source, key, options, workerPool));
+        }
+        catch (const std::exception &e)
+        {
+          Logger::log(LogLevel::Error, "Onnxruntime", e.what());
+          promise->reject(std::current_exception());
+        } });
+    }
+    catch (const std::exception &e)
+    {
+      Logger::log(LogLevel::Error, "Onnxruntime", e.what());
+      promise->reject(std::current_exception());
+    }
+    return promise;
+  }
+
+  std::shared_ptr<Promise<std::shared_ptr<HybridSessionPoolSpec>>> Onnxruntime::loadSessionPool(const std::string &modelPath, double replicas, const std::optional<SessionOptions> &options)
+  {
+    auto promise = Promise<std::shared_ptr<HybridSessionPoolSpec>>::create();
+    try
+    {
+      if (replicas < 1)
+      {
+        throw std::runtime_error("A session pool needs at least one replica");
+      }
+
+      // Replicas run side by side, so each one defaults to a single intra-op thread
+      std::optional<SessionOptions> replicaOptions = options.value_or(SessionOptions{});
+      if (!replicaOptions->intraOpNumThreads.has_value())
+        replicaOptions->intraOpNumThreads = 1;
+
+      auto self = std::dynamic_pointer_cast<Onnxruntime>(shared_from_this());
+      auto workerPool = workerPool_;
+      size_t count = static_cast<size_t>(replicas);
+      workerPool->submit([self, workerPool, promise, modelPath, count, replicaOptions]()
+                         {
+        try
+        {
+          ModelSource source{modelPath.rfind("file://", 0) == 0 ? modelPath.substr(7) : modelPath};
+          resolveWeightsVariant(source, replicaOptions);
+          std::string key = SessionRegistry::keyForFile(source.path, replicaOptions);
+
+          // Every replica needs an Ort::Session of its own. They share the weights and their packed copy
+          // instead of holding one each, see getSharedWeights(). Loaded one after the other so that
+          // later replicas find the weights already packed.
+          source.shareWeights = count > 1;
+          // Evicting some replicas would only have the others carry the load until they reload,
+          // the budget treats the pool as one session
+          auto evictionGroup = std::make_shared<char>();
+          std::vector<std::shared_ptr<InferenceSession>> sessions;
+          sessions.reserve(count);
+          for (size_t i = 0; i < count; i++)
+          {
+            sessions.push_back(self->loadSession(source, key + "|replica:" + std::to_string(i), replicaOptions, workerPool,
+                                                 evictionGroup));
+          }
+          promise->resolve(std::make_shared<SessionPool>(std::move(sessions)));
+        }
+        catch (const std::exception &e)
+        {
+          Logger::log(LogLevel::Error, "Onnxruntime", e.what());
+          promise->reject(std::current_exception());
+        } });
     }
     catch (const std::exception &e)
     {
       Logger::log(LogLevel::Error, "Onnxruntime", e.what());
-      promise->reject(std::make_exception_ptr(e));
+      promise->reject(std::current_exception());
     }
     return promise;
   }
@@ -2,8 +2,18 @@
 
 #include "HybridOnnxruntimeSpec.hpp"
 #include "InferenceSession.hpp"
+#include "MappedModel.hpp"
+#include "MemoryManager.hpp"
+#include "ModelCache.hpp"
+#include "SessionPool.hpp"
+#include "SessionRegistry.hpp"
+#include "SharedWeights.hpp"
+#include "WorkerPool.hpp"
 #include "onnxruntime_cxx_api.h"
+#include <atomic>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 
 // Include provider headers based on platform
@@ -22,7 +32,7 @@ namespace margelo::nitro::nitroonnxruntime
   {
   public:
     // Constructor
-    Onnxruntime() : HybridObject(TAG), env_(Ort::Env(ORT_LOGGING_LEVEL_WARNING, "Onnxruntime")) {}
+    Onnxruntime() : HybridObject(TAG), workerPool_(std::make_shared<WorkerPool>()), registry_(std::make_shared<SessionRegistry>()) {}
 
     // Destructor
     ~Onnxruntime() override = default;
@@ -32,11 +42,67 @@ namespace margelo::nitro::nitroonnxruntime
     std::string getVersion() override;
     std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> loadModel(const std::string &modelPath, const std::optional<SessionOptions> &options = std::nullopt) override;
     std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> loadModelFromBuffer(const std::shared_ptr<ArrayBuffer> &buffer, const std::optional<SessionOptions> &options = std::nullopt) override;
+    std::shared_ptr<Promise<std::shared_ptr<HybridInferenceSessionSpec>>> loadModelFromAsset(const std::string &assetPath, const std::optional<SessionOptions> &options = std::nullopt) override;
+    std::shared_ptr<Promise<std::shared_ptr<HybridSessionPoolSpec>>> loadSessionPool(const std::string &modelPath, double replicas, const std::optional<SessionOptions> &options = std::nullopt) override;
+    void configureWorkerPool(const WorkerPoolOptions &options) override;
+    void configureThreadPools(const ThreadPoolOptions &options) override;
+    void setMemoryBudget(double bytes) override;
+    void trimMemory(bool critical) override;
 
   private:
+    // Where a model is loaded from, either a file path, an in-memory buffer or a bundled asset
+    struct ModelSource
+    {
+      std::string path;
+      std::shared_ptr<ArrayBuffer> buffer;
+      std::string assetPath;
+      // Read-only mapping of the model, set for assets and ORT-format files
+      std::shared_ptr<MappedModel> mapping;
+      // Set once `path` or `assetPath` points at a weights variant of the requested model
+      std::string weightsVariant;
+      // hashModel() of `buffer`, computed once per load and shared by the registry and cache keys
+      uint64_t contentHash = 0;
+      // Load the weights of an ONNX-format file once for every session of it, see getSharedWeights()
+      bool shareWeights = false;
+    };
+
+    // Points the source at the weightsVariant of the model if it has been shipped
+    static void resolveWeightsVariant(ModelSource &source, const std::optional<SessionOptions> &options);
+
+    // Creates the environment on first use, so that global thread pools can still be configured before
+    Ort::Env &getEnv();
     void configureSessionOptions(Ort::SessionOptions &sessionOptions, const std::optional<SessionOptions> &options);
+    // Creates the session, going through the optimized model cache when one is configured
+    std::shared_ptr<Ort::Session> createSession(const ModelSource &source, const std::optional<SessionOptions> &options);
+    std::shared_ptr<Ort::Session> openSession(const ModelSource &source, Ort::SessionOptions &sessionOptions,
+                                              const std::shared_ptr<SharedWeights> &weights = nullptr);
+    // Weights of the model file at `path` for the sessions sharing them, read once while any of them is loaded.
+    // Only pays off for several sessions, a single one would hold the shared copy next to its packed one.
+    std::shared_ptr<SharedWeights> getSharedWeights(const std::string &path);
+    // Maps a model once for all the sessions loading it at the same time, so that ORT-format
+    // initializers used in place are shared as well
+    std::shared_ptr<MappedModel> mapShared(const std::string &key, const std::function<std::shared_ptr<MappedModel>()> &map);
+    // Creates an InferenceSession, sharing the Ort::Session with other holders of the same key
+    // unless profiling is enabled. Sessions of one `evictionGroup` are evicted together.
+    std::shared_ptr<InferenceSession> loadSession(const ModelSource &source, const std::string &key,
+                                                  const std::optional<SessionOptions> &options,
+                                                  const std::shared_ptr<WorkerPool> &workerPool,
+                                                  std::shared_ptr<const void> evictionGroup = nullptr);
     // ONNX Runtime environment (shared across sessions)
-    Ort::Env env_;
+    std::mutex envMutex_;
+    Ort::Env env_{nullptr};
+    // Thread pools the environment is created with, shared by sessions using useGlobalThreadPools
+    std::optional<ThreadPoolOptions> threadPoolOptions_;
+    // Native threads that model loading and inference are dispatched onto
+    std::shared_ptr<WorkerPool> workerPool_;
+    // Sessions currently loaded, shared between loads of the same model and options
+    std::shared_ptr<SessionRegistry> registry_;
+    // Sessions with profiling enabled are never shared, endProfiling() would end it for every holder
+    std::atomic<uint64_t> nextProfilingId_{0};
+    // Weights shared between sessions that can't share an Ort::Session, see getSharedWeights() and mapShared()
+    std::mutex sharedWeightsMutex_;
+    std::unordered_map<std::string, std::weak_ptr<SharedWeights>> sharedWeights_;
+    std::unordered_map<std::string, std::weak_ptr<MappedModel>> mappings_;
   };
 
 } // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,273 @@
+#include "Postprocessor.hpp"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define ONNXRUNTIME_POSTPROCESS_NEON 1
+#endif
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    std::vector<uint8_t> allocateResult(size_t byteSize)
+    {
+      // Empty results still need a valid allocation
+      std::vector<uint8_t> result;
+      result.reserve(std::max<size_t>(byteSize, 1));
+      result.resize(byteSize);
+      return result;
+    }
+
+    // Largest value that isn't NaN, NaN only if the whole row is
+    float rowMax(const float *row, size_t columns)
+    {
+      size_t i = 0;
+      float result = std::numeric_limits<float>::quiet_NaN();
+#if defined(ONNXRUNTIME_POSTPROCESS_NEON) && defined(__aarch64__)
+      // maxNum skips NaN the same way as the scalar loop, vmaxq_f32 would return it
+      if (columns >= 4)
+      {
+        float32x4_t maxima = vld1q_f32(row);
+        for (i = 4; i + 4 <= columns; i += 4)
+        {
+          maxima = vmaxnmq_f32(maxima, vld1q_f32(row + i));
+        }
+        result = vmaxnmvq_f32(maxima);
+      }
+#endif
+      for (; i < columns; i++)
+      {
+        if (std::isnan(result) || row[i] > result)
+          result = row[i];
+      }
+      return result;
+    }
+
+    // Column of the largest value that isn't NaN, 0 if the whole row is NaN
+    size_t argmaxIgnoringNaN(const float *row, size_t columns)
+    {
+      size_t best = 0;
+      bool found = false;
+      for (size_t i = 0; i < columns; i++)
+      {
+        if (std::isnan(row[i]))
+          continue;
+        if (!found || row[i] > row[best])
+        {
+          best = i;
+          found = true;
+        }
+      }
+      return best;
+    }
+
+    struct Detection
+    {
+      float x1, y1, x2, y2, score;
+      int32_t label;
+    };
+
+    float intersectionOverUnion(const Detection &a, const Detection &b)
+    {
+      float width = std::max(0.0f, std::min(a.x2, b.x2) - std::max(a.x1, b.x1));
+      float height = std::max(0.0f, std::min(a.y2, b.y2) - std::max(a.y1, b.y1));
+      float intersection = width * height;
+      float areaA = (a.x2 - a.x1) * (a.y2 - a.y1);
+      float areaB = (b.x2 - b.x1) * (b.y2 - b.y1);
+      float combined = areaA + areaB - intersection;
+      return combined > 0 ? intersection / combined : 0.0f;
+    }
+  } // namespace
+
+  Postprocessor::Postprocessor(const Config &config) : config_(config)
+  {
+    if (config_.kind == Kind::TopK && config_.k == 0)
+      throw std::runtime_error("k must be at least 1");
+    if (config_.kind == Kind::Yolo && config_.maxDetections == 0)
+      throw std::runtime_error("maxDetections must be at least 1");
+  }
+
+  Postprocessor::Kind Postprocessor::parseKind(const std::string &kind)
+  {
+    if (kind == "argmax")
+      return Kind::Argmax;
+    if (kind == "softmax")
+      return Kind::Softmax;
+    if (kind == "topk")
+      return Kind::TopK;
+    if (kind == "yolo")
+      return Kind::Yolo;
+    throw std::runtime_error("Unknown postprocessing type: " + kind);
+  }
+
+  std::optional<std::vector<uint8_t>> Postprocessor::process(float *output, size_t count,
+                                                             const std::vector<int64_t> &shape) const
+  {
+    if (shape.empty() || shape.back() <= 0)
+      throw std::runtime_error("Postprocessed outputs need a non-empty last dimension");
+
+    size_t columns = static_cast<size_t>(shape.back());
+    size_t rows = count / columns;
+
+    switch (config_.kind)
+    {
+    case Kind::Argmax:
+      return argmax(output, rows, columns);
+    case Kind::Softmax:
+      softmax(output, rows, columns);
+      return std::nullopt;
+    case Kind::TopK:
+      return topK(output, rows, columns);
+    case Kind::Yolo:
+      return yolo(output, shape);
+    }
+    return std::nullopt;
+  }
+
+  std::vector<uint8_t> Postprocessor::argmax(const float *data, size_t rows, size_t columns) const
+  {
+    auto result = allocateResult(rows * sizeof(int32_t));
+    int32_t *indices = reinterpret_cast<int32_t *>(result.data());
+    for (size_t r = 0; r < rows; r++)
+    {
+      const float *row = data + r * columns;
+      // The vectorized maximum first, then the first column holding it. The maximum is only NaN
+      // for a row of NaN, which the scan maps to column 0.
+      float maximum = rowMax(row, columns);
+      const float *found = std::isnan(maximum) ? row + columns : std::find(row, row + columns, maximum);
+      size_t index = found != row + columns ? static_cast<size_t>(found - row) : argmaxIgnoringNaN(row, columns);
+      indices[r] = static_cast<int32_t>(index);
+    }
+    return result;
+  }
+
+  void Postprocessor::softmax(float *data, size_t rows, size_t columns) const
+  {
+    for (size_t r = 0; r < rows; r++)
+    {
+      float *row = data + r * columns;
+      float maximum = rowMax(row, columns);
+      float total = 0;
+      // NaN logits get no probability, a row of NaN stays NaN (0 * 1/0)
+      for (size_t c = 0; c < columns; c++)
+      {
+        row[c] = std::isnan(row[c]) ? 0.0f : std::exp(row[c] - maximum);
+        total += row[c];
+      }
+      float inverse = 1.0f / total;
+      for (size_t c = 0; c < columns; c++)
+      {
+        row[c] *= inverse;
+      }
+    }
+  }
+
+  std::vector<uint8_t> Postprocessor::topK(const float *data, size_t rows, size_t columns) const
+  {
+    size_t k = std::min(config_.k, columns);
+    auto result = allocateResult(rows * k * 2 * sizeof(float));
+    float *pairs = reinterpret_cast<float *>(result.data());
+
+    std::vector<int32_t> order(columns);
+    for (size_t r = 0; r < rows; r++)
+    {
+      const float *row = data + r * columns;
+      std::iota(order.begin(), order.end(), 0);
+      // NaN sorts last, comparing it directly would break the ordering partial_sort relies on
+      std::partial_sort(order.begin(), order.begin() + k, order.end(), [row](int32_t a, int32_t b)
+                        { return !std::isnan(row[a]) && (std::isnan(row[b]) || row[a] > row[b]); });
+      for (size_t i = 0; i < k; i++)
+      {
+        pairs[(r * k + i) * 2] = static_cast<float>(order[i]);
+        pairs[(r * k + i) * 2 + 1] = row[order[i]];
+      }
+    }
+    return result;
+  }
+
+  std::vector<uint8_t> Postprocessor::yolo(const float *data, const std::vector<int64_t> &shape) const
+  {
+    if (shape.size() != 3 || shape[0] != 1)
+      throw std::runtime_error("YOLO outputs must have the shape [1, boxes, attributes] or [1, attributes, boxes]");
+
+    size_t boxes = static_cast<size_t>(config_.transposed ? shape[2] : shape[1]);
+    size_t attributes = static_cast<size_t>(config_.transposed ? shape[1] : shape[2]);
+    size_t firstClass = config_.hasObjectness ? 5 : 4;
+    if (attributes <= firstClass)
+      throw std::runtime_error("YOLO output has no class scores");
+
+    // Attribute `a` of box `b` in either layout
+    size_t boxStride = config_.transposed ? 1 : attributes;
+    size_t attributeStride = config_.transposed ? boxes : 1;
+
+    std::vector<Detection> candidates;
+    for (size_t b = 0; b < boxes; b++)
+    {
+      const float *box = data + b * boxStride;
+      // Negated comparisons also drop NaN scores
+      float objectness = config_.hasObjectness ? box[4 * attributeStride] : 1.0f;
+      if (!(objectness >= config_.scoreThreshold))
+        continue;
+
+      int32_t label = 0;
+      float best = box[firstClass * attributeStride];
+      for (size_t a = firstClass + 1; a < attributes; a++)
+      {
+        float score = box[a * attributeStride];
+        if (score > best || std::isnan(best))
+        {
+          best = score;
+          label = static_cast<int32_t>(a - firstClass);
+        }
+      }
+
+      float score = best * objectness;
+      if (!(score >= config_.scoreThreshold))
+        continue;
+
+      float centerX = box[0];
+      float centerY = box[attributeStride];
+      float halfWidth = box[2 * attributeStride] / 2;
+      float halfHeight = box[3 * attributeStride] / 2;
+      candidates.push_back({centerX - halfWidth, centerY - halfHeight, centerX + halfWidth, centerY + halfHeight, score, label});
+    }
+
+    // Greedy per-class NMS, best scores first
+    std::sort(candidates.begin(), candidates.end(), [](const Detection &a, const Detection &b)
+              { return a.score > b.score; });
+    std::vector<Detection> kept;
+    for (const auto &candidate : candidates)
+    {
+      bool suppressed = std::any_of(kept.begin(), kept.end(), [&](const Detection &other)
+                                    { return other.label == candidate.label &&
+                                             intersectionOverUnion(other, candidate) > config_.iouThreshold; });
+      if (suppressed)
+        continue;
+      kept.push_back(candidate);
+      if (kept.size() == config_.maxDetections)
+        break;
+    }
+
+    auto result = allocateResult(kept.size() * 6 * sizeof(float));
+    float *values = reinterpret_cast<float *>(result.data());
+    for (size_t i = 0; i < kept.size(); i++)
+    {
+      const Detection &detection = kept[i];
+      float *entry = values + i * 6;
+      entry[0] = detection.x1;
+      entry[1] = detection.y1;
+      entry[2] = detection.x2;
+      entry[3] = detection.y2;
+      entry[4] = detection.score;
+      entry[5] = static_cast<float>(detection.label);
+    }
+    return result;
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
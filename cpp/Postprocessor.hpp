@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Reduces a float32 output to the compact result JS actually reads, on the worker thread.
+  // Rows are taken along the last dimension of the output. NaN scores never win and get no softmax probability.
+  class Postprocessor
+  {
+  public:
+    enum class Kind
+    {
+      Argmax,  // int32 class index per row
+      Softmax, // float32 probabilities, same shape as the output (computed in place)
+      TopK,    // float32 [index, score] pairs, k per row, best first
+      Yolo     // float32 [x1, y1, x2, y2, score, class] per detection after NMS
+    };
+
+    struct Config
+    {
+      Kind kind = Kind::Argmax;
+      size_t k = 5;
+      float scoreThreshold = 0.25f;
+      float iouThreshold = 0.45f;
+      size_t maxDetections = 100;
+      bool hasObjectness = true; // YOLOv5 style [x, y, w, h, objectness, classes...]
+      bool transposed = false;   // YOLOv8 style [1, attributes, boxes]
+    };
+
+    explicit Postprocessor(const Config &config);
+
+    static Kind parseKind(const std::string &kind);
+
+    // `output` is the tensor memory of a float32 output of `shape` holding `count` values. Returns
+    // the result, or nothing if it was written over `output` in place (softmax).
+    std::optional<std::vector<uint8_t>> process(float *output, size_t count, const std::vector<int64_t> &shape) const;
+
+  private:
+    Config config_;
+
+    std::vector<uint8_t> argmax(const float *data, size_t rows, size_t columns) const;
+    void softmax(float *data, size_t rows, size_t columns) const;
+    std::vector<uint8_t> topK(const float *data, size_t rows, size_t columns) const;
+    std::vector<uint8_t> yolo(const float *data, const std::vector<int64_t> &shape) const;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,92 @@
+#include "Sampler.hpp"
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  Sampler::Sampler(SamplingParams params, uint64_t seed) : params_(params), random_(seed) {}
+
+  int64_t Sampler::sample(const float *logits, size_t vocabSize, const std::vector<int64_t> &history)
+  {
+    scores_.assign(logits, logits + vocabSize);
+
+    // CTRL-style penalty, applied once per distinct token that already occurred
+    if (params_.repetitionPenalty != 1.0f)
+    {
+      std::unordered_set<int64_t> seen;
+      for (int64_t token : history)
+      {
+        if (token < 0 || static_cast<size_t>(token) >= vocabSize || !seen.insert(token).second)
+          continue;
+        float &score = scores_[token];
+        score = score > 0 ? score / params_.repetitionPenalty : score * params_.repetitionPenalty;
+      }
+    }
+
+    if (params_.temperature <= 0.0f || params_.topK == 1)
+    {
+      return std::distance(scores_.begin(), std::max_element(scores_.begin(), scores_.end()));
+    }
+
+    candidates_.resize(vocabSize);
+    for (size_t i = 0; i < vocabSize; i++)
+    {
+      candidates_[i] = {scores_[i] / params_.temperature, static_cast<int64_t>(i)};
+    }
+
+    // Most likely first, only as far as top-k/top-p need it sorted
+    auto byScore = [](const auto &a, const auto &b)
+    { return a.first > b.first; };
+    if (params_.topK > 0 && params_.topK < candidates_.size())
+    {
+      std::partial_sort(candidates_.begin(), candidates_.begin() + params_.topK, candidates_.end(), byScore);
+      candidates_.resize(params_.topK);
+    }
+    else if (params_.topP < 1.0f)
+    {
+      std::sort(candidates_.begin(), candidates_.end(), byScore);
+    }
+
+    // Softmax over the remaining candidates
+    float maxScore = std::max_element(candidates_.begin(), candidates_.end(), [](const auto &a, const auto &b)
+                                      { return a.first < b.first; })
+                         ->first;
+    double total = 0;
+    for (auto &candidate : candidates_)
+    {
+      candidate.first = std::exp(candidate.first - maxScore);
+      total += candidate.first;
+    }
+
+    // Nucleus: keep the smallest prefix whose probability mass reaches topP
+    if (params_.topP < 1.0f)
+    {
+      double cumulative = 0;
+      size_t keep = 0;
+      while (keep < candidates_.size())
+      {
+        cumulative += candidates_[keep++].first / total;
+        if (cumulative >= params_.topP)
+          break;
+      }
+      candidates_.resize(keep);
+      total = 0;
+      for (const auto &candidate : candidates_)
+      {
+        total += candidate.first;
+      }
+    }
+
+    double threshold = std::uniform_real_distribution<double>(0.0, total)(random_);
+    for (const auto &candidate : candidates_)
+    {
+      threshold -= candidate.first;
+      if (threshold <= 0)
+        return candidate.second;
+    }
+    return candidates_.back().second;
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <utility>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  struct SamplingParams
+  {
+    float temperature = 1.0f;       // 0 picks the most likely token (greedy)
+    size_t topK = 0;                // 0 keeps all tokens
+    float topP = 1.0f;              // 1 keeps all tokens
+    float repetitionPenalty = 1.0f; // 1 disables the penalty
+  };
+
+  // Picks the next token from a row of logits, on the native side so that the logits
+  // never have to be handed to JS.
+  class Sampler
+  {
+  public:
+    Sampler(SamplingParams params, uint64_t seed);
+
+    // `history` are the tokens of the sequence so far, used for the repetition penalty
+    int64_t sample(const float *logits, size_t vocabSize, const std::vector<int64_t> &history);
+
+  private:
+    SamplingParams params_;
+    std::mt19937_64 random_;
+    // Reused across tokens to avoid reallocating vocabulary sized buffers
+    std::vector<float> scores_;
+    std::vector<std::pair<float, int64_t>> candidates_;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,207 @@
+#include "SessionPool.hpp"
+#include <NitroModules/NitroLogger.hpp>
+#include <stdexcept>
+#include <string>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  SessionPool::SessionPool(std::vector<std::shared_ptr<InferenceSession>> replicas)
+      : HybridObject(TAG), state_(std::make_shared<State>())
+  {
+    if (replicas.empty())
+      throw std::runtime_error("A session pool needs at least one replica");
+
+    state_->replicas = std::move(replicas);
+    state_->maxQueueSize = state_->replicas.size() * DEFAULT_MAX_QUEUE_SIZE_PER_REPLICA;
+    state_->queues.reserve(state_->replicas.size());
+    for (size_t i = 0; i < state_->replicas.size(); i++)
+    {
+      state_->queues.push_back(std::make_unique<Queue>());
+    }
+
+    threads_.reserve(state_->replicas.size());
+    for (size_t i = 0; i < state_->replicas.size(); i++)
+    {
+      threads_.emplace_back(workerLoop, state_, i);
+    }
+  }
+
+  SessionPool::~SessionPool()
+  {
+    if (!state_)
+      return;
+
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->stopping = true;
+    }
+    state_->condition.notify_all();
+
+    // The pool is released on the JS thread, which must not wait for queued runs. The threads
+    // hold the state and the replicas, they drain the queues so that every Promise is settled
+    // and then exit on their own.
+    for (auto &thread : threads_)
+    {
+      if (thread.joinable())
+        thread.detach();
+    }
+  }
+
+  double SessionPool::getSize()
+  {
+    return state_ ? static_cast<double>(state_->replicas.size()) : 0;
+  }
+
+  std::vector<Tensor> SessionPool::getInputNames()
+  {
+    return state_ ? state_->replicas.front()->getInputNames() : std::vector<Tensor>{};
+  }
+
+  std::vector<Tensor> SessionPool::getOutputNames()
+  {
+    return state_ ? state_->replicas.front()->getOutputNames() : std::vector<Tensor>{};
+  }
+
+  std::shared_ptr<Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>> SessionPool::run(
+      const InferenceSession::FeedMap &feeds, const std::optional<RunOptions> &options)
+  {
+    using BufferMap = std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>;
+    auto promise = Promise<BufferMap>::create();
+    try
+    {
+      if (!state_)
+        throw std::runtime_error("Session pool has no replicas, it must be created through Onnxruntime.loadSessionPool");
+
+      // The run may end up on any replica's thread, so feeds are always copied here on the JS thread.
+      // All replicas are the same model, the first one pins the feeds and tracks the run for terminate().
+      auto &first = state_->replicas.front();
+      auto pinnedFeeds = first->pinFeeds(feeds, true);
+      auto context = first->createRunContext(options);
+      submit([promise, pinnedFeeds = std::move(pinnedFeeds), context](InferenceSession &replica)
+             {
+        try
+        {
+          promise->resolve(replica.runInternal(pinnedFeeds, context.get()));
+        }
+        catch (...)
+        {
+          promise->reject(std::current_exception());
+        } });
+    }
+    catch (...)
+    {
+      promise->reject(std::current_exception());
+    }
+    return promise;
+  }
+
+  void SessionPool::terminate(const std::optional<std::string> &tag)
+  {
+    if (state_)
+      state_->replicas.front()->terminate(tag);
+  }
+
+  void SessionPool::dispose()
+  {
+    if (!state_)
+      return;
+    // Queued runs are rejected by their replica once it has let go of its session
+    for (const auto &replica : state_->replicas)
+    {
+      replica->dispose();
+    }
+  }
+
+  void SessionPool::submit(Job job)
+  {
+    auto &state = *state_;
+    size_t count = state.queues.size();
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (state.stopping)
+      {
+        throw std::runtime_error("Session pool is shutting down");
+      }
+      if (state.pending >= state.maxQueueSize)
+      {
+        throw std::runtime_error("Inference queue is full (" + std::to_string(state.maxQueueSize) +
+                                 " pending jobs), try again once earlier runs have completed");
+      }
+
+      // Hand the run to an idle replica, otherwise spread runs round robin and let stealing even it out
+      size_t start = state.nextReplica.fetch_add(1) % count;
+      Queue *target = state.queues[start].get();
+      for (size_t i = 0; i < count; i++)
+      {
+        auto &queue = *state.queues[(start + i) % count];
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        if (!queue.busy && queue.jobs.empty())
+        {
+          target = &queue;
+          break;
+        }
+      }
+
+      // Counted before it is queued, so that `pending` never drops below the number of queued runs
+      state.pending++;
+      std::lock_guard<std::mutex> queueLock(target->mutex);
+      target->jobs.push_back(std::move(job));
+    }
+    // Whichever worker wakes up takes the run, from its own queue or by stealing it
+    state.condition.notify_one();
+  }
+
+  bool SessionPool::takeJob(State &state, size_t replica, Job &job)
+  {
+    size_t count = state.queues.size();
+    // Own queue first, then the oldest run of the other replicas
+    for (size_t i = 0; i < count; i++)
+    {
+      auto &queue = *state.queues[(replica + i) % count];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (queue.jobs.empty())
+        continue;
+      job = std::move(queue.jobs.front());
+      queue.jobs.pop_front();
+      state.pending--;
+      return true;
+    }
+    return false;
+  }
+
+  void SessionPool::workerLoop(std::shared_ptr<State> state, size_t replica)
+  {
+    auto &queue = *state->queues[replica];
+    while (true)
+    {
+      Job job;
+      if (!takeJob(*state, replica, job))
+      {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->condition.wait(lock, [&state]()
+                              { return state->stopping || state->pending > 0; });
+        if (state->stopping && state->pending == 0)
+          return;
+        continue;
+      }
+
+      queue.busy = true;
+      // Jobs settle their own Promise, anything escaping here must not take the thread down
+      try
+      {
+        job(*state->replicas[replica]);
+      }
+      catch (const std::exception &e)
+      {
+        Logger::log(LogLevel::Error, "Onnxruntime", "Uncaught error in a session pool run: %s", e.what());
+      }
+      catch (...)
+      {
+        Logger::log(LogLevel::Error, "Onnxruntime", "Uncaught error in a session pool run");
+      }
+      queue.busy = false;
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
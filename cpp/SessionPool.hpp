@@ -0,0 +1,75 @@
+#pragma once
+
+#include "HybridSessionPoolSpec.hpp"
+#include "InferenceSession.hpp"
+#include <NitroModules/Promise.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Replicas of one model with a native thread each, so that concurrent runs don't queue behind
+  // each other on a single session. Every replica has its own queue, runs go to an idle replica
+  // if there is one and idle replicas steal queued runs from busy ones.
+  class SessionPool : public virtual HybridSessionPoolSpec
+  {
+  public:
+    static constexpr size_t DEFAULT_MAX_QUEUE_SIZE_PER_REPLICA = WorkerPool::DEFAULT_MAX_QUEUE_SIZE;
+
+    SessionPool() : HybridObject(TAG) {}
+    explicit SessionPool(std::vector<std::shared_ptr<InferenceSession>> replicas);
+    ~SessionPool() override;
+
+    SessionPool(const SessionPool &) = delete;
+    SessionPool &operator=(const SessionPool &) = delete;
+
+  public:
+    double getSize() override;
+    std::vector<Tensor> getInputNames() override;
+    std::vector<Tensor> getOutputNames() override;
+    std::shared_ptr<Promise<std::unordered_map<std::string, std::shared_ptr<ArrayBuffer>>>> run(
+        const InferenceSession::FeedMap &feeds, const std::optional<RunOptions> &options) override;
+    void terminate(const std::optional<std::string> &tag) override;
+    void dispose() override;
+
+  private:
+    // Gets the replica it runs on
+    using Job = std::function<void(InferenceSession &)>;
+
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<Job> jobs;
+      std::atomic<bool> busy{false};
+    };
+
+    // Shared with the worker threads
+    struct State
+    {
+      std::vector<std::shared_ptr<InferenceSession>> replicas;
+      std::vector<std::unique_ptr<Queue>> queues;
+      // Guards adding jobs and sleeping, a queue's own mutex is only ever taken after this one
+      std::mutex mutex;
+      std::condition_variable condition;
+      std::atomic<size_t> pending{0};
+      std::atomic<size_t> nextReplica{0};
+      size_t maxQueueSize = 0;
+      bool stopping = false;
+    };
+
+    void submit(Job job);
+    static bool takeJob(State &state, size_t replica, Job &job);
+    static void workerLoop(std::shared_ptr<State> state, size_t replica);
+
+    std::shared_ptr<State> state_;
+    std::vector<std::thread> threads_;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
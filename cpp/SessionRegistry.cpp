@@ -0,0 +1,140 @@
+#include "SessionRegistry.hpp"
+#include "ModelCache.hpp"
+#include <map>
+#include <variant>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    void append(std::string &key, const char *name, const std::optional<double> &value)
+    {
+      if (value.has_value())
+        key += std::string(";") + name + "=" + std::to_string(value.value());
+    }
+
+    void append(std::string &key, const char *name, const std::optional<bool> &value)
+    {
+      if (value.has_value())
+        key += std::string(";") + name + "=" + (value.value() ? "1" : "0");
+    }
+
+    void append(std::string &key, const char *name, const std::optional<std::string> &value)
+    {
+      if (value.has_value())
+        key += std::string(";") + name + "=" + value.value();
+    }
+
+    // Unlike the model cache, sessions are only shared when every option matches
+    std::string describeAllSessionOptions(const std::optional<SessionOptions> &options)
+    {
+      std::string key = describeSessionOptions(options);
+      if (!options.has_value())
+        return key;
+
+      append(key, "intraOpNumThreads", options->intraOpNumThreads);
+      append(key, "interOpNumThreads", options->interOpNumThreads);
+      append(key, "enableCpuMemArena", options->enableCpuMemArena);
+      append(key, "enableMemPattern", options->enableMemPattern);
+      append(key, "executionMode", options->executionMode);
+      append(key, "logId", options->logId);
+      append(key, "logSeverityLevel", options->logSeverityLevel);
+      append(key, "optimizedModelFilePath", options->optimizedModelFilePath);
+      append(key, "modelCacheDirectory", options->modelCacheDirectory);
+      append(key, "useGlobalThreadPools", options->useGlobalThreadPools);
+      append(key, "enableProfiling", options->enableProfiling);
+      append(key, "profileFilePrefix", options->profileFilePrefix);
+      append(key, "weightsVariant", options->weightsVariant);
+      append(key, "weightsVariantFallback", options->weightsVariantFallback);
+      append(key, "disablePrepacking", options->disablePrepacking);
+
+      if (options->executionProviders.has_value())
+      {
+        for (const auto &provider : options->executionProviders.value())
+        {
+          if (!std::holds_alternative<ProviderOptions>(provider))
+            continue;
+          const auto &providerOptions = std::get<ProviderOptions>(provider);
+          key += ";provider=" + providerOptions.name;
+          append(key, "useCPUOnly", providerOptions.useCPUOnly);
+          append(key, "useCPUAndGPU", providerOptions.useCPUAndGPU);
+          append(key, "enableOnSubgraph", providerOptions.enableOnSubgraph);
+          append(key, "onlyEnableDeviceWithANE", providerOptions.onlyEnableDeviceWithANE);
+          append(key, "useFP16", providerOptions.useFP16);
+          append(key, "useNCHW", providerOptions.useNCHW);
+          append(key, "cpuDisabled", providerOptions.cpuDisabled);
+          append(key, "cpuOnly", providerOptions.cpuOnly);
+        }
+      }
+      return key;
+    }
+  } // namespace
+
+  std::string SessionRegistry::keyForFile(const std::string &modelPath, const std::optional<SessionOptions> &options)
+  {
+    return "file:" + modelPath + "|" + describeAllSessionOptions(options);
+  }
+
+  std::string SessionRegistry::keyForAsset(const std::string &assetPath, const std::optional<SessionOptions> &options)
+  {
+    return "asset:" + assetPath + "|" + describeAllSessionOptions(options);
+  }
+
+  std::string SessionRegistry::keyForBuffer(uint64_t contentHash, size_t size, const std::optional<SessionOptions> &options)
+  {
+    return "buffer:" + std::to_string(contentHash) + ":" + std::to_string(size) + "|" +
+           describeAllSessionOptions(options);
+  }
+
+  std::shared_ptr<Ort::Session> SessionRegistry::acquire(const std::string &key, const Factory &factory)
+  {
+    std::promise<std::shared_ptr<Ort::Session>> loading;
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      auto it = entries_.find(key);
+      if (it != entries_.end())
+      {
+        // Already loaded or being loaded by another caller, wait for that load
+        it->second.refCount++;
+        auto session = it->second.session;
+        lock.unlock();
+        return session.get();
+      }
+
+      entries_.emplace(key, Entry{loading.get_future().share(), 1});
+    }
+
+    try
+    {
+      auto session = factory();
+      loading.set_value(session);
+      return session;
+    }
+    catch (...)
+    {
+      // Forget the failed load so that the next attempt starts over,
+      // callers that joined it receive the same error
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(key);
+      }
+      loading.set_exception(std::current_exception());
+      throw;
+    }
+  }
+
+  void SessionRegistry::release(const std::string &key)
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it == entries_.end())
+      return;
+
+    if (--it->second.refCount == 0)
+    {
+      entries_.erase(it);
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "SessionOptions.hpp"
+#include "onnxruntime_cxx_api.h"
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Ref-counted registry of loaded sessions, so that loading the same model with the same
+  // options shares one Ort::Session (and its weights) instead of creating a new one each time.
+  class SessionRegistry
+  {
+  public:
+    using Factory = std::function<std::shared_ptr<Ort::Session>()>;
+
+    // Returns the session for `key`, joining an in-flight load or creating it through `factory`.
+    // Every successful acquire() has to be balanced by a release() of the same key.
+    std::shared_ptr<Ort::Session> acquire(const std::string &key, const Factory &factory);
+    // Drops one reference, the entry is removed once the last holder has released it
+    void release(const std::string &key);
+
+    // Registry key for a model loaded from a file
+    static std::string keyForFile(const std::string &modelPath, const std::optional<SessionOptions> &options);
+    // Registry key for a model bundled with the app
+    static std::string keyForAsset(const std::string &assetPath, const std::optional<SessionOptions> &options);
+    // Registry key for a model loaded from memory, `contentHash` comes from hashModel()
+    static std::string keyForBuffer(uint64_t contentHash, size_t size, const std::optional<SessionOptions> &options);
+
+  private:
+    struct Entry
+    {
+      std::shared_future<std::shared_ptr<Ort::Session>> session;
+      size_t refCount = 0;
+    };
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
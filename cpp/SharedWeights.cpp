@@ -0,0 +1,48 @@
+#include "SharedWeights.hpp"
+#include "ModelInitializers.hpp"
+#include <cstring>
+#include <new>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    // What ONNX Runtime aligns its own tensors to
+    constexpr std::align_val_t ALIGNMENT{64};
+    // Small initializers such as shapes and biases aren't worth sharing, sessions keep their own
+    constexpr size_t MIN_SHARED_BYTES = 4096;
+  } // namespace
+
+  void SharedWeights::AlignedDelete::operator()(uint8_t *data) const
+  {
+    ::operator delete[](data, ALIGNMENT);
+  }
+
+  SharedWeights::SharedWeights(const uint8_t *model, size_t size)
+  {
+    auto memoryInfo = Ort::MemoryInfo::CreateCpu(OrtArenaAllocator, OrtMemTypeDefault);
+    for (const auto &inlineInitializer : readInlineInitializers(model, size, MIN_SHARED_BYTES))
+    {
+      // raw_data sits at any offset of the model, copy it out aligned
+      Initializer initializer;
+      initializer.name = inlineInitializer.name;
+      initializer.data.reset(static_cast<uint8_t *>(::operator new[](inlineInitializer.byteSize, ALIGNMENT)));
+      std::memcpy(initializer.data.get(), inlineInitializer.data, inlineInitializer.byteSize);
+      initializer.value = Ort::Value::CreateTensor(memoryInfo, initializer.data.get(), inlineInitializer.byteSize,
+                                                   inlineInitializer.dims.data(), inlineInitializer.dims.size(),
+                                                   static_cast<ONNXTensorElementDataType>(inlineInitializer.dataType));
+      byteSize_ += inlineInitializer.byteSize;
+      initializers_.push_back(std::move(initializer));
+    }
+  }
+
+  void SharedWeights::addTo(Ort::SessionOptions &sessionOptions) const
+  {
+    for (const auto &initializer : initializers_)
+    {
+      sessionOptions.AddInitializer(initializer.name.c_str(), initializer.value);
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
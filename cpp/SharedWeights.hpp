@@ -0,0 +1,49 @@
+#pragma once
+
+#include "onnxruntime_cxx_api.h"
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // The weights of an ONNX-format model held once for several sessions of it, e.g. the replicas
+  // of a SessionPool. Each session adds them through AddInitializer() instead of keeping a copy
+  // of its own, and ONNX Runtime packs them once into prepackedWeights() for all of them.
+  // Sessions have to keep this alive for as long as they exist.
+  class SharedWeights
+  {
+  public:
+    // Copies the initializers stored inline in the serialized model, see readInlineInitializers()
+    SharedWeights(const uint8_t *model, size_t size);
+
+    SharedWeights(const SharedWeights &) = delete;
+    SharedWeights &operator=(const SharedWeights &) = delete;
+
+    void addTo(Ort::SessionOptions &sessionOptions) const;
+    OrtPrepackedWeightsContainer *prepackedWeights() const { return prepackedWeights_; }
+    size_t byteSize() const { return byteSize_; }
+    bool empty() const { return initializers_.empty(); }
+
+  private:
+    struct AlignedDelete
+    {
+      void operator()(uint8_t *data) const;
+    };
+
+    struct Initializer
+    {
+      std::string name;
+      std::unique_ptr<uint8_t[], AlignedDelete> data;
+      Ort::Value value{nullptr};
+    };
+
+    std::vector<Initializer> initializers_;
+    Ort::PrepackedWeightsContainer prepackedWeights_;
+    size_t byteSize_ = 0;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,55 @@
+#include "StateShape.hpp"
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  namespace
+  {
+    // Size of the fed dynamic dimension called `name`, -1 if no feed has one
+    int64_t findNamedDim(const std::string &name, const std::vector<FedShape> &feeds)
+    {
+      for (const auto &feed : feeds)
+      {
+        for (size_t i = 0; i < feed.symbolicDims.size() && i < feed.shape.size() && i < feed.modelDims.size(); i++)
+        {
+          if (feed.modelDims[i] < 0 && feed.symbolicDims[i] == name)
+            return feed.shape[i];
+        }
+      }
+      return -1;
+    }
+
+    // Batch size of the feeds, taken from the first one with a dynamic first dimension
+    int64_t findBatchSize(const std::vector<FedShape> &feeds)
+    {
+      for (const auto &feed : feeds)
+      {
+        if (!feed.modelDims.empty() && feed.modelDims[0] < 0 && !feed.shape.empty())
+          return feed.shape[0];
+      }
+      return 1;
+    }
+  } // namespace
+
+  std::vector<int64_t> initialStateShape(const std::vector<int64_t> &dims, const std::vector<std::string> &symbolicDims,
+                                         const std::vector<FedShape> &feeds)
+  {
+    std::vector<int64_t> shape = dims;
+    for (size_t i = 0; i < shape.size(); i++)
+    {
+      if (shape[i] >= 0)
+        continue;
+
+      bool named = i < symbolicDims.size() && !symbolicDims[i].empty();
+      int64_t fed = named ? findNamedDim(symbolicDims[i], feeds) : -1;
+      if (fed >= 0)
+        shape[i] = fed;
+      else if (i == 0)
+        shape[i] = findBatchSize(feeds);
+      else
+        shape[i] = 0;
+    }
+    return shape;
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
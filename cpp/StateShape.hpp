@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // An input fed to a run, next to how the model describes it
+  struct FedShape
+  {
+    std::vector<int64_t> modelDims;        // Negative for dynamic dimensions
+    std::vector<std::string> symbolicDims; // Names of the dimensions, empty for unnamed ones
+    std::vector<int64_t> shape;            // Shape of the fed tensor
+  };
+
+  // Shape of the state a new sequence starts from, e.g. an empty [batch, heads, past, headDim]
+  // KV cache. A dynamic dimension named like a dynamic dimension of a fed input (batch_size)
+  // takes its size, any other dynamic first dimension is the batch of the feeds. The remaining
+  // dynamic dimensions, such as the past sequence length, are 0.
+  std::vector<int64_t> initialStateShape(const std::vector<int64_t> &dims, const std::vector<std::string> &symbolicDims,
+                                         const std::vector<FedShape> &feeds);
+
+} // namespace margelo::nitro::nitroonnxruntime
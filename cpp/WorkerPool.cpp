@@ -0,0 +1,91 @@
+#include "WorkerPool.hpp"
+#include <NitroModules/NitroLogger.hpp>
+#include <stdexcept>
+#include <string>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  WorkerPool::WorkerPool(size_t numThreads, size_t maxQueueSize) : state_(std::make_shared<State>())
+  {
+    state_->maxQueueSize = maxQueueSize > 0 ? maxQueueSize : 1;
+    if (numThreads == 0)
+      numThreads = 1;
+
+    threads_.reserve(numThreads);
+    for (size_t i = 0; i < numThreads; i++)
+    {
+      threads_.emplace_back(workerLoop, state_);
+    }
+  }
+
+  WorkerPool::~WorkerPool()
+  {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      state_->stopping = true;
+    }
+    state_->condition.notify_all();
+
+    for (auto &thread : threads_)
+    {
+      // The last reference to the pool can be dropped by one of its own jobs (a job holding the
+      // session that holds the pool). That thread can't join itself, it exits once it sees stopping.
+      if (thread.get_id() == std::this_thread::get_id())
+        thread.detach();
+      else if (thread.joinable())
+        thread.join();
+    }
+  }
+
+  void WorkerPool::submit(std::function<void()> job)
+  {
+    {
+      std::lock_guard<std::mutex> lock(state_->mutex);
+      if (state_->stopping)
+      {
+        throw std::runtime_error("Worker pool is shutting down");
+      }
+      if (state_->queue.size() >= state_->maxQueueSize)
+      {
+        throw std::runtime_error("Inference queue is full (" + std::to_string(state_->maxQueueSize) +
+                                 " pending jobs), try again once earlier runs have completed");
+      }
+      state_->queue.push_back(std::move(job));
+    }
+    state_->condition.notify_one();
+  }
+
+  void WorkerPool::workerLoop(std::shared_ptr<State> state)
+  {
+    while (true)
+    {
+      std::function<void()> job;
+      {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->condition.wait(lock, [&state]()
+                              { return state->stopping || !state->queue.empty(); });
+        if (state->stopping && state->queue.empty())
+          return;
+        job = std::move(state->queue.front());
+        state->queue.pop_front();
+      }
+
+      // Jobs are responsible for reporting their own errors (e.g. by rejecting a Promise),
+      // anything escaping here must not take the whole worker thread down
+      try
+      {
+        job();
+      }
+      catch (const std::exception &e)
+      {
+        Logger::log(LogLevel::Error, "Onnxruntime", "Uncaught error in a worker job: %s", e.what());
+      }
+      catch (...)
+      {
+        Logger::log(LogLevel::Error, "Onnxruntime", "Uncaught error in a worker job");
+      }
+    }
+  }
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace margelo::nitro::nitroonnxruntime
+{
+
+  // Fixed-size pool of native threads used to run inference off the JS thread.
+  // The job queue is bounded: once it is full, submit() throws so the caller can
+  // reject the Promise instead of piling up work (backpressure).
+  class WorkerPool
+  {
+  public:
+    static constexpr size_t DEFAULT_NUM_THREADS = 2;
+    static constexpr size_t DEFAULT_MAX_QUEUE_SIZE = 32;
+
+    WorkerPool(size_t numThreads = DEFAULT_NUM_THREADS, size_t maxQueueSize = DEFAULT_MAX_QUEUE_SIZE);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Enqueue a job, throws std::runtime_error if the queue is full
+    void submit(std::function<void()> job);
+
+    size_t getNumThreads() const { return threads_.size(); }
+    size_t getMaxQueueSize() const { return state_->maxQueueSize; }
+
+  private:
+    // Shared with the worker threads so that the pool may be destroyed from one of its own jobs
+    struct State
+    {
+      std::mutex mutex;
+      std::condition_variable condition;
+      std::deque<std::function<void()>> queue;
+      size_t maxQueueSize;
+      bool stopping = false;
+    };
+
+    static void workerLoop(std::shared_ptr<State> state);
+
+    std::shared_ptr<State> state_;
+    std::vector<std::thread> threads_;
+  };
+
+} // namespace margelo::nitro::nitroonnxruntime
@@ -0,0 +1,133 @@
+#include "HalfPrecision.hpp"
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <limits>
+#include <vector>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  uint16_t toHalf(float value)
+  {
+    uint16_t half;
+    HalfPrecision::floatToHalf(&value, &half, 1);
+    return half;
+  }
+
+  float fromHalf(uint16_t half)
+  {
+    float value;
+    HalfPrecision::halfToFloat(&half, &value, 1);
+    return value;
+  }
+
+  uint16_t toBFloat16(float value)
+  {
+    uint16_t bfloat;
+    HalfPrecision::floatToBFloat16(&value, &bfloat, 1);
+    return bfloat;
+  }
+
+  float fromBits(uint32_t bits)
+  {
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+  }
+} // namespace
+
+TEST(HalfPrecisionTest, ExactValuesConvert)
+{
+  EXPECT_EQ(toHalf(0.0f), 0x0000);
+  EXPECT_EQ(toHalf(-0.0f), 0x8000);
+  EXPECT_EQ(toHalf(1.0f), 0x3C00);
+  EXPECT_EQ(toHalf(-2.0f), 0xC000);
+  EXPECT_EQ(toHalf(65504.0f), 0x7BFF);
+}
+
+TEST(HalfPrecisionTest, RoundsToNearestEven)
+{
+  // Halfway between 1 and the next half, 1 has the even mantissa
+  EXPECT_EQ(toHalf(1.0f + 0x1.0p-11f), 0x3C00);
+  // Halfway between the first and second step above 1, rounds up to the even second
+  EXPECT_EQ(toHalf(1.0f + 3 * 0x1.0p-11f), 0x3C02);
+  EXPECT_EQ(toHalf(1.0f + 0x1.8p-11f), 0x3C01);
+}
+
+TEST(HalfPrecisionTest, OverflowBecomesInfinity)
+{
+  EXPECT_EQ(toHalf(65520.0f), 0x7C00);
+  EXPECT_EQ(toHalf(-1e10f), 0xFC00);
+  EXPECT_EQ(toHalf(std::numeric_limits<float>::infinity()), 0x7C00);
+  EXPECT_EQ(toHalf(-std::numeric_limits<float>::infinity()), 0xFC00);
+}
+
+TEST(HalfPrecisionTest, NaNStaysNaN)
+{
+  uint16_t half = toHalf(std::numeric_limits<float>::quiet_NaN());
+  EXPECT_EQ(half & 0x7C00, 0x7C00);
+  EXPECT_NE(half & 0x03FF, 0);
+  EXPECT_TRUE(std::isnan(fromHalf(0x7E00)));
+  EXPECT_TRUE(std::isnan(fromHalf(0xFC01)));
+}
+
+TEST(HalfPrecisionTest, SubnormalsAreKept)
+{
+  EXPECT_EQ(toHalf(0x1.0p-24f), 0x0001);
+  EXPECT_EQ(toHalf(1023 * 0x1.0p-24f), 0x03FF);
+  // Ties between subnormals round to even too
+  EXPECT_EQ(toHalf(0x1.0p-25f), 0x0000);
+  EXPECT_EQ(toHalf(3 * 0x1.0p-25f), 0x0002);
+  EXPECT_EQ(fromHalf(0x0001), 0x1.0p-24f);
+  EXPECT_EQ(fromHalf(0x83FF), -1023 * 0x1.0p-24f);
+}
+
+TEST(HalfPrecisionTest, EveryHalfRoundTrips)
+{
+  // More than one vector wide, so that both the vectorized and the scalar paths are covered
+  std::vector<uint16_t> halves;
+  for (uint32_t bits = 0; bits <= 0xFFFF; bits++)
+  {
+    bool isNaN = (bits & 0x7C00) == 0x7C00 && (bits & 0x03FF) != 0;
+    if (!isNaN)
+      halves.push_back(static_cast<uint16_t>(bits));
+  }
+  std::vector<float> values(halves.size());
+  std::vector<uint16_t> roundTrip(halves.size());
+  HalfPrecision::halfToFloat(halves.data(), values.data(), halves.size());
+  HalfPrecision::floatToHalf(values.data(), roundTrip.data(), values.size());
+  EXPECT_EQ(roundTrip, halves);
+}
+
+TEST(HalfPrecisionTest, BFloat16RoundsToNearestEven)
+{
+  EXPECT_EQ(toBFloat16(1.0f), 0x3F80);
+  EXPECT_EQ(toBFloat16(1.0f + 0x1.0p-8f), 0x3F80);
+  EXPECT_EQ(toBFloat16(1.0f + 3 * 0x1.0p-8f), 0x3F82);
+  EXPECT_EQ(toBFloat16(-0.0f), 0x8000);
+  // The largest float rounds up to infinity
+  EXPECT_EQ(toBFloat16(std::numeric_limits<float>::max()), 0x7F80);
+}
+
+TEST(HalfPrecisionTest, BFloat16KeepsNaNQuiet)
+{
+  // A signalling NaN whose payload would be rounded away must not carry into infinity
+  float values[5] = {fromBits(0x7F800001u), fromBits(0xFFFFFFFFu), std::numeric_limits<float>::quiet_NaN(),
+                     std::numeric_limits<float>::infinity(), 0x1.0p-130f};
+  uint16_t bfloats[5];
+  HalfPrecision::floatToBFloat16(values, bfloats, 5);
+  EXPECT_EQ(bfloats[0], 0x7FC0);
+  EXPECT_EQ(bfloats[1], 0xFFFF);
+  EXPECT_EQ(bfloats[2] & 0x7FC0, 0x7FC0);
+  EXPECT_EQ(bfloats[3], 0x7F80);
+  // Subnormals keep their upper bits like any other value
+  EXPECT_EQ(bfloats[4], 0x0008);
+
+  float back[5];
+  HalfPrecision::bfloat16ToFloat(bfloats, back, 5);
+  EXPECT_TRUE(std::isnan(back[0]));
+  EXPECT_TRUE(std::isnan(back[1]));
+  EXPECT_EQ(back[4], 0x1.0p-130f);
+}
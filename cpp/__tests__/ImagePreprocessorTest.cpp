@@ -0,0 +1,176 @@
+#include "ImagePreprocessor.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  ImagePreprocessor::Config identity(ImagePreprocessor::PixelFormat format, size_t width, size_t height)
+  {
+    ImagePreprocessor::Config config;
+    config.format = format;
+    config.sourceWidth = width;
+    config.sourceHeight = height;
+    config.targetWidth = width;
+    config.targetHeight = height;
+    config.scale = 1.0f;
+    return config;
+  }
+} // namespace
+
+TEST(ImagePreprocessorTest, PaddedRowsAreSkippedWithBytesPerRow)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::RGBA, 2, 2));
+  // 2x2 RGBA with 4 bytes of padding after every row
+  const uint8_t frame[] = {1, 2, 3, 0, 4, 5, 6, 0, 99, 99, 99, 99,
+                           7, 8, 9, 0, 10, 11, 12, 0, 99, 99, 99, 99};
+  float output[12];
+  preprocessor.process(frame, sizeof(frame), 2, 2, 12, 0, output);
+
+  const float expected[12] = {1, 4, 7, 10, 2, 5, 8, 11, 3, 6, 9, 12};
+  for (size_t i = 0; i < 12; i++)
+    EXPECT_FLOAT_EQ(output[i], expected[i]) << "at " << i;
+}
+
+TEST(ImagePreprocessorTest, PaddingAfterTheLastRowMayBeLeftOut)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::RGB, 1, 2));
+  const uint8_t frame[] = {1, 2, 3, 0, 4, 5, 6};
+  float output[6];
+  preprocessor.process(frame, sizeof(frame), 1, 2, 4, 0, output);
+
+  const float expected[6] = {1, 4, 2, 5, 3, 6};
+  for (size_t i = 0; i < 6; i++)
+    EXPECT_FLOAT_EQ(output[i], expected[i]) << "at " << i;
+}
+
+TEST(ImagePreprocessorTest, WrongSizeWithoutStrideIsRejected)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::RGBA, 2, 2));
+  uint8_t frame[24] = {};
+  float output[12];
+  // A padded frame read as packed rows would be skewed
+  EXPECT_THROW(preprocessor.process(frame, 24, 2, 2, 0, 0, output), std::runtime_error);
+  EXPECT_THROW(preprocessor.process(frame, 15, 2, 2, 0, 0, output), std::runtime_error);
+  EXPECT_NO_THROW(preprocessor.process(frame, 16, 2, 2, 0, 0, output));
+}
+
+TEST(ImagePreprocessorTest, StrideShorterThanARowIsRejected)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::RGBA, 2, 2));
+  uint8_t frame[16] = {};
+  float output[12];
+  EXPECT_THROW(preprocessor.process(frame, 16, 2, 2, 4, 0, output), std::runtime_error);
+  EXPECT_THROW(preprocessor.process(frame, 16, 2, 2, 12, 0, output), std::runtime_error);
+}
+
+TEST(ImagePreprocessorTest, Nv21PlanesUseTheStride)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::NV21, 2, 2));
+  // Luma 2x2 and one V/U pair, every row padded to 4 bytes. Neutral chroma keeps it grey.
+  const uint8_t frame[] = {16, 235, 0, 0,
+                           235, 16, 0, 0,
+                           128, 128, 0, 0};
+  float output[12];
+  preprocessor.process(frame, sizeof(frame), 2, 2, 4, 0, output);
+
+  for (int c = 0; c < 3; c++)
+  {
+    EXPECT_FLOAT_EQ(output[c * 4 + 0], 0);
+    EXPECT_FLOAT_EQ(output[c * 4 + 1], 255);
+    EXPECT_FLOAT_EQ(output[c * 4 + 2], 255);
+    EXPECT_FLOAT_EQ(output[c * 4 + 3], 0);
+  }
+}
+
+TEST(ImagePreprocessorTest, Nv21ChromaIsReadAtTheUvOffset)
+{
+  ImagePreprocessor preprocessor(identity(ImagePreprocessor::PixelFormat::NV21, 2, 2));
+  // Two bytes of padding between the planes, read as chroma they would tint the frame
+  const uint8_t frame[] = {16, 235, 235, 16, 0, 0, 128, 128};
+  float output[12];
+  preprocessor.process(frame, sizeof(frame), 2, 2, 0, 6, output);
+
+  for (int c = 0; c < 3; c++)
+  {
+    EXPECT_FLOAT_EQ(output[c * 4 + 0], 0);
+    EXPECT_FLOAT_EQ(output[c * 4 + 1], 255);
+  }
+  EXPECT_THROW(preprocessor.process(frame, sizeof(frame), 2, 2, 0, 2, output), std::runtime_error);
+  EXPECT_THROW(preprocessor.process(frame, sizeof(frame), 2, 2, 0, 5, output), std::runtime_error);
+
+  ImagePreprocessor rgba(identity(ImagePreprocessor::PixelFormat::RGBA, 1, 2));
+  EXPECT_THROW(rgba.process(frame, sizeof(frame), 1, 2, 0, 4, output), std::runtime_error);
+}
+
+TEST(ImagePreprocessorTest, FrameSizeCountsTheStride)
+{
+  using PixelFormat = ImagePreprocessor::PixelFormat;
+  EXPECT_EQ(ImagePreprocessor::frameSize(PixelFormat::RGBA, 3, 2), 24u);
+  EXPECT_EQ(ImagePreprocessor::frameSize(PixelFormat::RGBA, 3, 2, 16), 32u);
+  EXPECT_EQ(ImagePreprocessor::frameSize(PixelFormat::NV21, 3, 3), 9u + 8u);
+  EXPECT_EQ(ImagePreprocessor::frameSize(PixelFormat::NV21, 3, 3, 8), 24u + 16u);
+  EXPECT_EQ(ImagePreprocessor::frameSize(PixelFormat::NV21, 3, 3, 8, 30), 30u + 16u);
+}
+
+TEST(ImagePreprocessorTest, InterleavedBgrLayoutIsNormalized)
+{
+  auto config = identity(ImagePreprocessor::PixelFormat::BGRA, 2, 1);
+  config.planar = false;
+  config.scale = 1.0f / 255.0f;
+  config.mean[0] = 0.5f;
+  config.std[0] = 0.5f;
+  ImagePreprocessor preprocessor(config);
+  EXPECT_EQ(preprocessor.outputShape(), (std::vector<int64_t>{1, 1, 2, 3}));
+
+  // BGRA pixels, read as RGB with the first channel normalized
+  const uint8_t frame[] = {0, 0, 255, 0, 255, 51, 0, 0};
+  float output[6];
+  preprocessor.process(frame, sizeof(frame), 2, 1, 0, 0, output);
+
+  const float expected[6] = {1, 0, 0, -1, 0.2f, 1};
+  for (size_t i = 0; i < 6; i++)
+    EXPECT_NEAR(output[i], expected[i], 1e-6f) << "at " << i;
+}
+
+TEST(ImagePreprocessorTest, ResizingKeepsAUniformFrameUniform)
+{
+  auto config = identity(ImagePreprocessor::PixelFormat::RGB, 7, 5);
+  config.targetWidth = 3;
+  config.targetHeight = 4;
+  ImagePreprocessor preprocessor(config);
+  EXPECT_EQ(preprocessor.outputShape(), (std::vector<int64_t>{1, 3, 4, 3}));
+
+  std::vector<uint8_t> frame(7 * 5 * 3);
+  for (size_t i = 0; i < frame.size(); i += 3)
+  {
+    frame[i] = 10;
+    frame[i + 1] = 20;
+    frame[i + 2] = 30;
+  }
+  std::vector<float> output(3 * 4 * 3);
+  preprocessor.process(frame.data(), frame.size(), 7, 5, 0, 0, output.data());
+  for (size_t i = 0; i < output.size(); i++)
+    EXPECT_FLOAT_EQ(output[i], (i / 12 + 1) * 10.0f) << "at " << i;
+}
+
+TEST(ImagePreprocessorTest, ResizingKeepsFractionalValues)
+{
+  auto config = identity(ImagePreprocessor::PixelFormat::RGB, 2, 1);
+  config.targetWidth = 1;
+  ImagePreprocessor preprocessor(config);
+
+  // Halfway between 0 and 1, which a blend rounded to bytes would turn into 1
+  const uint8_t frame[] = {0, 0, 0, 1, 1, 1};
+  float output[3];
+  preprocessor.process(frame, sizeof(frame), 2, 1, 0, 0, output);
+  for (int c = 0; c < 3; c++)
+    EXPECT_FLOAT_EQ(output[c], 0.5f);
+}
+
+TEST(ImagePreprocessorTest, UnknownFormatsAreRejected)
+{
+  EXPECT_EQ(ImagePreprocessor::parseFormat("nv21"), ImagePreprocessor::PixelFormat::NV21);
+  EXPECT_THROW(ImagePreprocessor::parseFormat("yuv420"), std::runtime_error);
+}
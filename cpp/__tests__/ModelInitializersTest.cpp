@@ -0,0 +1,122 @@
+#include "ModelInitializers.hpp"
+#include <gtest/gtest.h>
+#include <stdexcept>
+#include <string>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  // Minimal protobuf encoding, enough to build ModelProtos by hand
+  std::string varint(uint64_t value)
+  {
+    std::string bytes;
+    while (value >= 0x80)
+    {
+      bytes += static_cast<char>((value & 0x7F) | 0x80);
+      value >>= 7;
+    }
+    bytes += static_cast<char>(value);
+    return bytes;
+  }
+
+  std::string varintField(uint32_t field, uint64_t value)
+  {
+    return varint(field << 3) + varint(value);
+  }
+
+  std::string bytesField(uint32_t field, const std::string &value)
+  {
+    return varint((field << 3) | 2) + varint(value.size()) + value;
+  }
+
+  // TensorProto with unpacked dims
+  std::string tensor(const std::string &name, int32_t dataType, const std::vector<int64_t> &dims, const std::string &rawData)
+  {
+    std::string proto;
+    for (int64_t dim : dims)
+      proto += varintField(1, static_cast<uint64_t>(dim));
+    proto += varintField(2, static_cast<uint64_t>(dataType));
+    proto += bytesField(8, name);
+    proto += bytesField(9, rawData);
+    return proto;
+  }
+
+  std::string model(const std::vector<std::string> &initializers)
+  {
+    std::string graph = bytesField(2, "graph");
+    for (const auto &initializer : initializers)
+      graph += bytesField(5, initializer);
+    // ir_version before the graph, producer_name after it
+    return varintField(1, 8) + bytesField(7, graph) + bytesField(2, "test");
+  }
+
+  std::vector<InlineInitializer> read(const std::string &proto, size_t minByteSize = 0)
+  {
+    return readInlineInitializers(reinterpret_cast<const uint8_t *>(proto.data()), proto.size(), minByteSize);
+  }
+} // namespace
+
+TEST(ModelInitializersTest, RawDataInitializersPointIntoTheModel)
+{
+  std::string weights(2 * 3 * 4, '\x01');
+  std::string proto = model({tensor("weight", 1, {2, 3}, weights), tensor("ids", 7, {2}, std::string(16, '\x02'))});
+  auto initializers = read(proto);
+
+  ASSERT_EQ(initializers.size(), 2u);
+  EXPECT_EQ(initializers[0].name, "weight");
+  EXPECT_EQ(initializers[0].dataType, 1);
+  EXPECT_EQ(initializers[0].dims, (std::vector<int64_t>{2, 3}));
+  EXPECT_EQ(initializers[0].byteSize, 24u);
+  EXPECT_EQ(std::string(reinterpret_cast<const char *>(initializers[0].data), initializers[0].byteSize), weights);
+  EXPECT_GE(initializers[0].data, reinterpret_cast<const uint8_t *>(proto.data()));
+  EXPECT_EQ(initializers[1].name, "ids");
+  EXPECT_EQ(initializers[1].dims, (std::vector<int64_t>{2}));
+}
+
+TEST(ModelInitializersTest, PackedDimsAndScalarsAreRead)
+{
+  std::string packed = bytesField(1, varint(4) + varint(300)) + varintField(2, 10) + bytesField(8, "half") +
+                       bytesField(9, std::string(4 * 300 * 2, '\0'));
+  auto initializers = read(model({packed, tensor("scale", 1, {}, std::string(4, '\0'))}));
+
+  ASSERT_EQ(initializers.size(), 2u);
+  EXPECT_EQ(initializers[0].dims, (std::vector<int64_t>{4, 300}));
+  EXPECT_EQ(initializers[0].byteSize, 2400u);
+  EXPECT_TRUE(initializers[1].dims.empty());
+  EXPECT_EQ(initializers[1].byteSize, 4u);
+}
+
+TEST(ModelInitializersTest, InitializersNotStoredInlineAreSkipped)
+{
+  // float_data instead of raw_data
+  std::string typed = varintField(1, 1) + varintField(2, 1) + bytesField(8, "typed") + bytesField(4, std::string(4, '\0'));
+  // data_location EXTERNAL, raw_data is left empty by exporters
+  std::string external = tensor("external", 1, {1}, std::string(4, '\0')) + varintField(14, 1);
+  std::string strings = tensor("strings", 8, {1}, "abc");
+  std::string wrongSize = tensor("wrong", 1, {4}, std::string(8, '\0'));
+  std::string small = tensor("small", 1, {1}, std::string(4, '\0'));
+  std::string large = tensor("large", 1, {64}, std::string(256, '\0'));
+
+  auto initializers = read(model({typed, external, strings, wrongSize, small, large}), 16);
+  ASSERT_EQ(initializers.size(), 1u);
+  EXPECT_EQ(initializers[0].name, "large");
+}
+
+TEST(ModelInitializersTest, UnknownFieldsOfEveryWireTypeAreSkipped)
+{
+  std::string fixed64 = varint((20 << 3) | 1) + std::string(8, '\x7F');
+  std::string fixed32 = varint((21 << 3) | 5) + std::string(4, '\x7F');
+  std::string proto = fixed64 + fixed32 + model({tensor("weight", 1, {1}, std::string(4, '\0'))});
+  EXPECT_EQ(read(proto).size(), 1u);
+}
+
+TEST(ModelInitializersTest, MalformedModelsAreRejected)
+{
+  std::string proto = model({tensor("weight", 1, {16}, std::string(64, '\0'))});
+  // Cut into the middle of the graph
+  EXPECT_THROW(read(proto.substr(0, proto.size() / 2)), std::runtime_error);
+  // Group wire types were never used by ONNX
+  EXPECT_THROW(read(varint((3 << 3) | 3)), std::runtime_error);
+  EXPECT_TRUE(read("").empty());
+}
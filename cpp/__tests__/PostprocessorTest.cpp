@@ -0,0 +1,110 @@
+#include "Postprocessor.hpp"
+#include <cmath>
+#include <cstring>
+#include <gtest/gtest.h>
+#include <limits>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  constexpr float kNaN = std::numeric_limits<float>::quiet_NaN();
+
+  Postprocessor make(Postprocessor::Kind kind, size_t k = 5)
+  {
+    Postprocessor::Config config;
+    config.kind = kind;
+    config.k = k;
+    return Postprocessor(config);
+  }
+
+  template <typename T>
+  std::vector<T> valuesOf(const std::vector<uint8_t> &bytes)
+  {
+    std::vector<T> values(bytes.size() / sizeof(T));
+    std::memcpy(values.data(), bytes.data(), values.size() * sizeof(T));
+    return values;
+  }
+} // namespace
+
+TEST(PostprocessorTest, ArgmaxPicksTheFirstLargestColumn)
+{
+  // Long enough rows for the vectorized maximum
+  std::vector<float> output = {0, 3, 1, 3, 2, 0, 0, 0, 0,
+                               9, 0, 0, 0, 0, 0, 0, 0, 10};
+  auto result = make(Postprocessor::Kind::Argmax).process(output.data(), output.size(), {2, 9});
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(valuesOf<int32_t>(*result), (std::vector<int32_t>{1, 8}));
+}
+
+TEST(PostprocessorTest, ArgmaxSkipsNaN)
+{
+  std::vector<float> output = {kNaN, 1, 2, 0, 0, 0, 0, 0, 0,
+                               1, 2, 0, 0, kNaN, 0, 0, 0, 0,
+                               0, 0, 0, 0, 0, 0, 0, 5, kNaN};
+  auto result = make(Postprocessor::Kind::Argmax).process(output.data(), output.size(), {3, 9});
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(valuesOf<int32_t>(*result), (std::vector<int32_t>{2, 1, 7}));
+}
+
+TEST(PostprocessorTest, ArgmaxOfAnAllNaNRowIsInRange)
+{
+  std::vector<float> output(6, kNaN);
+  auto result = make(Postprocessor::Kind::Argmax).process(output.data(), output.size(), {2, 3});
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(valuesOf<int32_t>(*result), (std::vector<int32_t>{0, 0}));
+}
+
+TEST(PostprocessorTest, SoftmaxIsComputedInPlace)
+{
+  std::vector<float> output = {0, 0, std::log(2.0f)};
+  auto result = make(Postprocessor::Kind::Softmax).process(output.data(), output.size(), {1, 3});
+  EXPECT_FALSE(result.has_value());
+  EXPECT_FLOAT_EQ(output[0], 0.25f);
+  EXPECT_FLOAT_EQ(output[1], 0.25f);
+  EXPECT_FLOAT_EQ(output[2], 0.5f);
+}
+
+TEST(PostprocessorTest, SoftmaxGivesNaNNoProbability)
+{
+  // NaN first and inside the vectorized part, a row of NaN stays NaN
+  std::vector<float> output = {kNaN, 0, 0, std::log(2.0f), kNaN,
+                               kNaN, kNaN, kNaN, kNaN, kNaN};
+  auto result = make(Postprocessor::Kind::Softmax).process(output.data(), output.size(), {2, 5});
+  EXPECT_FALSE(result.has_value());
+  const float expected[5] = {0, 0.25f, 0.25f, 0.5f, 0};
+  for (size_t i = 0; i < 5; i++)
+    EXPECT_FLOAT_EQ(output[i], expected[i]) << "at " << i;
+  for (size_t i = 5; i < 10; i++)
+    EXPECT_TRUE(std::isnan(output[i])) << "at " << i;
+}
+
+TEST(PostprocessorTest, TopKSortsNaNLast)
+{
+  std::vector<float> output = {0.1f, kNaN, 0.7f, 0.2f, kNaN};
+  auto result = make(Postprocessor::Kind::TopK, 3).process(output.data(), output.size(), {1, 5});
+  ASSERT_TRUE(result.has_value());
+  EXPECT_EQ(valuesOf<float>(*result), (std::vector<float>{2, 0.7f, 3, 0.2f, 0, 0.1f}));
+}
+
+TEST(PostprocessorTest, YoloDropsNaNScores)
+{
+  // [1, boxes, x y w h objectness class0 class1]
+  std::vector<float> output = {10, 10, 4, 4, 0.9f, 0.1f, 0.8f,
+                               50, 50, 4, 4, kNaN, 0.9f, 0.9f,
+                               90, 90, 4, 4, 0.9f, kNaN, kNaN};
+  auto result = make(Postprocessor::Kind::Yolo).process(output.data(), output.size(), {1, 3, 7});
+  ASSERT_TRUE(result.has_value());
+  auto detections = valuesOf<float>(*result);
+  ASSERT_EQ(detections.size(), 6u);
+  EXPECT_FLOAT_EQ(detections[0], 8);
+  EXPECT_FLOAT_EQ(detections[3], 12);
+  EXPECT_FLOAT_EQ(detections[4], 0.9f * 0.8f);
+  EXPECT_FLOAT_EQ(detections[5], 1);
+}
+
+TEST(PostprocessorTest, EmptyLastDimensionIsRejected)
+{
+  std::vector<float> output;
+  EXPECT_THROW(make(Postprocessor::Kind::Argmax).process(output.data(), 0, {1, 0}), std::runtime_error);
+}
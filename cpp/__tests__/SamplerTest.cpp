@@ -0,0 +1,76 @@
+#include "Sampler.hpp"
+#include <gtest/gtest.h>
+#include <set>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  const std::vector<float> logits = {1.0f, 4.0f, 3.0f, 0.5f, 3.5f};
+
+  std::set<int64_t> sampled(SamplingParams params, size_t draws = 500)
+  {
+    Sampler sampler(params, 42);
+    std::set<int64_t> tokens;
+    for (size_t i = 0; i < draws; i++)
+      tokens.insert(sampler.sample(logits.data(), logits.size(), {}));
+    return tokens;
+  }
+} // namespace
+
+TEST(SamplerTest, ZeroTemperatureIsGreedy)
+{
+  SamplingParams params;
+  params.temperature = 0;
+  EXPECT_EQ(sampled(params), (std::set<int64_t>{1}));
+}
+
+TEST(SamplerTest, TopKOfOneIsGreedy)
+{
+  SamplingParams params;
+  params.topK = 1;
+  EXPECT_EQ(sampled(params), (std::set<int64_t>{1}));
+}
+
+TEST(SamplerTest, TopKLimitsTheCandidates)
+{
+  SamplingParams params;
+  params.topK = 2;
+  EXPECT_EQ(sampled(params), (std::set<int64_t>{1, 4}));
+}
+
+TEST(SamplerTest, TopPKeepsTheSmallestNucleus)
+{
+  SamplingParams params;
+  // 1 alone holds about 47% of the mass, 1 and 4 together about 76%
+  params.topP = 0.5f;
+  EXPECT_EQ(sampled(params), (std::set<int64_t>{1, 4}));
+  params.topP = 0.4f;
+  EXPECT_EQ(sampled(params), (std::set<int64_t>{1}));
+}
+
+TEST(SamplerTest, FullDistributionReachesEveryToken)
+{
+  EXPECT_EQ(sampled(SamplingParams{}, 5000), (std::set<int64_t>{0, 1, 2, 3, 4}));
+}
+
+TEST(SamplerTest, RepetitionPenaltyAppliesOncePerToken)
+{
+  SamplingParams params;
+  params.temperature = 0;
+  params.repetitionPenalty = 1.5f;
+  Sampler sampler(params, 0);
+  // 4 / 1.5 falls below 3.5, a second occurrence must not penalize it again
+  EXPECT_EQ(sampler.sample(logits.data(), logits.size(), {1}), 4);
+  EXPECT_EQ(sampler.sample(logits.data(), logits.size(), {1, 1, 1}), 4);
+  // 3.5 / 1.5 and 4 / 1.5 leave 3 ahead, out of range tokens are ignored
+  EXPECT_EQ(sampler.sample(logits.data(), logits.size(), {1, 4, -1, 99}), 2);
+}
+
+TEST(SamplerTest, SameSeedSamplesTheSameTokens)
+{
+  Sampler first(SamplingParams{}, 7);
+  Sampler second(SamplingParams{}, 7);
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(first.sample(logits.data(), logits.size(), {}), second.sample(logits.data(), logits.size(), {}));
+}
@@ -0,0 +1,57 @@
+#include "StateShape.hpp"
+#include <gtest/gtest.h>
+
+using namespace margelo::nitro::nitroonnxruntime;
+
+namespace
+{
+  // input_ids of a decoder, [batch_size, sequence_length]
+  FedShape inputIds(int64_t batch, int64_t length)
+  {
+    return FedShape{{-1, -1}, {"batch_size", "sequence_length"}, {batch, length}};
+  }
+} // namespace
+
+TEST(StateShapeTest, KvCacheTakesTheBatchOfTheFeedsAndAnEmptyPast)
+{
+  // past_key_values.0.key, [batch_size, num_heads, past_sequence_length, head_dim]
+  auto shape = initialStateShape({-1, 32, -1, 128}, {"batch_size", "", "past_sequence_length", ""}, {inputIds(4, 7)});
+  EXPECT_EQ(shape, (std::vector<int64_t>{4, 32, 0, 128}));
+}
+
+TEST(StateShapeTest, UnnamedBatchIsTheFirstDynamicDimensionOfTheFeeds)
+{
+  FedShape ids{{-1, -1}, {"", ""}, {2, 5}};
+  auto shape = initialStateShape({-1, 8, -1, 64}, {"", "", "", ""}, {ids});
+  EXPECT_EQ(shape, (std::vector<int64_t>{2, 8, 0, 64}));
+}
+
+TEST(StateShapeTest, NamedDimensionsMatchAcrossAllFeeds)
+{
+  FedShape mask{{-1, -1}, {"batch", "total_sequence_length"}, {3, 9}};
+  FedShape encoder{{-1, -1, 512}, {"batch", "encoder_sequence_length", ""}, {3, 20, 512}};
+  // Cross attention state of an encoder-decoder, sized by the encoder output
+  auto shape = initialStateShape({-1, 8, -1, 64}, {"batch", "", "encoder_sequence_length", ""}, {mask, encoder});
+  EXPECT_EQ(shape, (std::vector<int64_t>{3, 8, 20, 64}));
+}
+
+TEST(StateShapeTest, BatchDefaultsToOneWithoutBatchedFeeds)
+{
+  FedShape fixed{{1, 16}, {"", ""}, {1, 16}};
+  auto shape = initialStateShape({-1, 4, -1}, {"batch_size", "", "past"}, {fixed});
+  EXPECT_EQ(shape, (std::vector<int64_t>{1, 4, 0}));
+}
+
+TEST(StateShapeTest, FixedSizeStatesKeepTheirShape)
+{
+  // Recurrent hidden state, [num_layers, batch, hidden]
+  auto shape = initialStateShape({2, 1, 256}, {"", "", ""}, {inputIds(1, 1)});
+  EXPECT_EQ(shape, (std::vector<int64_t>{2, 1, 256}));
+}
+
+TEST(StateShapeTest, BatchInsideTheShapeIsFoundByName)
+{
+  // [num_layers, batch_size, hidden] with a dynamic batch
+  auto shape = initialStateShape({2, -1, 256}, {"", "batch_size", ""}, {inputIds(6, 3)});
+  EXPECT_EQ(shape, (std::vector<int64_t>{2, 6, 256}));
+}
@@ -1,6 +1,8 @@
 import type { HybridObject } from 'react-native-nitro-modules';
 export interface Tensor {
   readonly dims: readonly number[];
+  // float32 | float64 | float16 | bfloat16 | int8 | int16 | int32 | int64 | uint8 | uint16 |
+  // uint32 | uint64 | bool | string. Strings are passed as UTF-8, each one terminated by a NUL byte.
   readonly type: string;
   readonly name: string;
 }
@@ -27,16 +29,267 @@ interface SessionOptions {
   executionProviders?: ExecutionProvider[];
   logId?: string;
   logSeverityLevel?: number;
+  freeDimensionOverrides?: Record<string, number>;
+  optimizedModelFilePath?: string;
+  // Directory to cache optimized ORT-format models in across app launches
+  modelCacheDirectory?: string;
+  // Size limit of the cache directory, least recently used models are removed first (default 512 MB)
+  modelCacheMaxBytes?: number;
+  // Run on the thread pools set up by configureThreadPools() instead of creating per-session threads
+  useGlobalThreadPools?: boolean;
+  // Profiled sessions get their own native session instead of sharing one with other loads of
+  // the model, so that endProfiling() only ends their own trace
+  enableProfiling?: boolean;
+  // Path prefix of the profiling trace in a writable directory such as the app's cache
+  // directory, required with enableProfiling
+  profileFilePrefix?: string;
+  // Loads a copy shipped next to the model instead, e.g. 'int8' loads model.int8.onnx for model.onnx.
+  // Nothing is quantized on the device: produce the variant offline (e.g. onnxruntime's
+  // quantize_dynamic) and bundle it. Loading fails when the file is missing.
+  weightsVariant?: string;
+  weightsVariantFallback?: boolean; // Load the model itself when the weightsVariant file is missing
+  // Skips the packed copy ONNX Runtime makes of MatMul/Gemm weights, lowers memory at some speed cost.
+  // Each session packs its own copy, only the replicas of a session pool share one.
+  disablePrepacking?: boolean;
+}
+
+interface ThreadPoolOptions {
+  intraOpNumThreads?: number; // Threads shared by all sessions within an operator (default: one per core)
+  interOpNumThreads?: number; // Threads shared by all sessions across operators (parallel execution mode)
+  allowSpinning?: boolean; // Busy-wait for work before sleeping, trades power for latency (default true)
+  intraOpThreadAffinities?: string; // ONNX Runtime affinity string, e.g. "1,2;3,4" pins 2 threads to cores 1-2 and 3-4
+}
+
+interface WorkerPoolOptions {
+  numThreads?: number; // Native threads running loads and inference (default 2)
+  maxQueueSize?: number; // Pending jobs before calls are rejected (default 32)
+}
+
+interface AutoBatchingOptions {
+  maxBatchSize: number; // Max number of run() calls stacked into one batch
+  maxWaitMicros: number; // Max time the first call waits for others to join
+}
+
+// A feed with an explicit shape, required for inputs with more than one dynamic dimension
+interface TensorFeed {
+  data: ArrayBuffer;
+  dims: number[];
+}
+
+type Feed = ArrayBuffer | TensorFeed;
+
+interface RunOptions {
+  tag?: string; // Shows up in logs, and lets terminate() target this run
+  logSeverityLevel?: number;
+  logVerbosityLevel?: number;
+  // Arenas to shrink once the run has finished, e.g. "cpu:0"
+  memoryArenaShrinkage?: string;
+  configEntries?: Record<string, string>;
+  // Only compute and return these outputs, lets ONNX Runtime skip the rest of the graph.
+  // runBound() always computes the outputs passed to bindOutputs().
+  outputNames?: string[];
+}
+
+interface GenerateOptions {
+  promptTokens: number[];
+  maxNewTokens: number;
+  stopTokens?: number[]; // Generation ends after any of these
+  temperature?: number; // 0 always picks the most likely token (default 1)
+  topK?: number;
+  topP?: number;
+  repetitionPenalty?: number;
+  seed?: number;
+  inputIdsName?: string; // Token ids input (default "input_ids")
+  // Filled with ones / the token positions, int32 or int64. The defaults are only fed when the
+  // model has such an input, a name given here must exist.
+  attentionMaskName?: string; // (default "attention_mask")
+  positionIdsName?: string; // (default "position_ids")
+  logitsName?: string; // Logits output (default "logits")
+  tag?: string; // Lets terminate() target this generation
+}
+
+interface ImagePreprocessing {
+  format: string; // Frame pixel format: 'rgba' | 'bgra' | 'rgb' | 'bgr' | 'nv21'
+  // Frame size, frames of another size can be fed as { data, dims: [height, width] }
+  width: number;
+  height: number;
+  // Row stride of frames with padded rows, e.g. a camera frame's bytesPerRow (default: rows
+  // are tightly packed). Frames of another size pass theirs as dims [height, width, bytesPerRow].
+  bytesPerRow?: number;
+  // nv21: byte offset of the V/U plane, for buffers where it doesn't follow the Y plane directly
+  // (default: bytesPerRow * height). Frames of another size pass dims [height, width, bytesPerRow, uvOffset].
+  uvOffset?: number;
+  targetWidth?: number; // Defaults to the input's width, required if it is dynamic
+  targetHeight?: number; // Defaults to the input's height, required if it is dynamic
+  layout?: string; // 'nchw' (default) | 'nhwc'
+  bgr?: boolean; // Channel order of the tensor (default RGB)
+  scale?: number; // Applied before mean/std (default 1/255)
+  mean?: number[];
+  std?: number[];
+}
+
+// Reductions of a float32 output, applied natively so that only their result is returned:
+// argmax: Int32 index per row, softmax: Float32 probabilities in place,
+// topk: Float32 [index, score] pairs per row, yolo: Float32 [x1, y1, x2, y2, score, class] per box
+interface Postprocessing {
+  type: string; // 'argmax' | 'softmax' | 'topk' | 'yolo'
+  k?: number; // topk (default 5)
+  scoreThreshold?: number; // yolo (default 0.25)
+  iouThreshold?: number; // yolo NMS (default 0.45)
+  maxDetections?: number; // yolo (default 100)
+  hasObjectness?: boolean; // yolo, false for YOLOv8 style heads (default true)
+  transposed?: boolean; // yolo, true for [1, attributes, boxes] heads such as YOLOv8 (default false)
+}
+
+interface BenchmarkOptions {
+  feeds: Record<string, Feed>;
+  warmup?: number; // Untimed runs before measuring (default 5)
+  iterations?: number; // Timed runs (default 50)
+}
+
+// Timings of runs made natively, without JS scheduling or marshalling in the numbers
+interface BenchmarkResult {
+  iterations: number;
+  meanMs: number;
+  p50Ms: number;
+  p90Ms: number;
+  p99Ms: number;
+  minMs: number;
+  maxMs: number;
+  throughput: number; // Runs per second
+  tensorCreationMs: number; // Mean time spent creating input tensors
+  runMs: number; // Mean time spent in Session::Run
+  outputMs: number; // Mean time spent handing outputs over as ArrayBuffers
+}
+
+interface MemoryUsage {
+  modelBytes: number; // Size of the model file or buffer that was loaded
+  weightsVariant: string; // The weightsVariant that was loaded, empty for the model itself
+  // Growth of the process's resident memory while the session was created, approximate since other
+  // work runs at the same time. Memory that is shared is counted for the load that created it only:
+  // about 0 for a session reused from an earlier load of the model, and pool replicas after the
+  // first leave out the weights they share.
+  loadResidentBytes: number;
+  residentBytes: number; // Current resident memory of the whole process (physical footprint on iOS)
+  evicted: boolean; // Unloaded to stay within the memory budget, reloads on its next run
+}
+
+// Counters kept for every session since it was loaded or since resetStats(), except
+// processPeakRssBytes
+interface RunStats {
+  runCount: number;
+  totalLatencyMs: number; // Summed over all runs
+  lastLatencyMs: number;
+  bytesIn: number; // Input tensor bytes fed to the model
+  bytesOut: number; // Output tensor bytes produced by the model
+  bytesCopied: number; // Feed bytes copied into native memory before running
+  droppedFrames: number; // runSync() calls skipped because the session was busy
+  // Peak resident memory of the whole process since it started (ru_maxrss): the same for every
+  // session, never decreases and isn't reset by resetStats()
+  processPeakRssBytes: number;
 }
 
 export interface InferenceSession
   extends HybridObject<{ ios: 'c++'; android: 'c++' }> {
   readonly inputNames: Tensor[];
   readonly outputNames: Tensor[];
+  // Bind feed ArrayBuffers directly instead of copying them. The buffers must not
+  // be modified until the Promise returned by run() has settled.
+  zeroCopyInputs: boolean;
+  // Feed and return float16/bfloat16 tensors as float32 values, converted natively. Applies to
+  // runs started afterwards, bound outputs keep the model's type.
+  convertHalfPrecision: boolean;
+  run(
+    feeds: Record<string, Feed>,
+    options?: RunOptions
+  ): Promise<Record<string, ArrayBuffer>>;
+  // Runs on the calling thread and returns the outputs directly, e.g. from a camera frame
+  // processor worklet with the frame's ArrayBuffer. Camera rows are usually padded, feed frames
+  // as { data, dims: [frame.height, frame.width, frame.bytesPerRow] } to a preprocessed input
+  // so that the stride reaches the conversion. Feeds are always used in place. While
+  // another run of this session is in flight the frame is dropped and undefined is returned,
+  // unless dropIfBusy is false. Blocks the JS thread when called from it. An evicted session
+  // reloads on a worker thread, frames are dropped until then (runSync throws with dropIfBusy false).
+  runSync(
+    feeds: Record<string, Feed>,
+    options?: RunOptions,
+    dropIfBusy?: boolean
+  ): Record<string, ArrayBuffer> | undefined;
+  // Cancels queued and in-flight runs, only the ones with the given tag if one is passed.
+  // Their Promises are rejected.
+  terminate(tag?: string): void;
+  // Binds caller-owned buffers that runBound() writes its outputs into.
+  // Only the bound outputs are computed, the buffers are reused across runs.
+  bindOutputs(outputs: Record<string, Feed>): void;
+  clearBoundOutputs(): void;
+  runBound(feeds: Record<string, Feed>, options?: RunOptions): Promise<void>;
+  // Stacks the feeds along the dynamic batch (first) dimension, runs them
+  // once and splits the outputs back up per request
+  runBatch(
+    feeds: Record<string, ArrayBuffer>[]
+  ): Promise<Record<string, ArrayBuffer>[]>;
+  // Coalesces concurrent run() calls into batches, pass undefined to disable
+  setAutoBatching(options?: AutoBatchingOptions): void;
+  // Runs the feeds in a native loop and reports latency percentiles and per-phase timings.
+  // Benchmark runs are not counted in getStats() and every iteration starts from an empty
+  // state, the state carried between run() calls is left as it was.
+  benchmark(options: BenchmarkOptions): Promise<BenchmarkResult>;
+  // Feeds outputs back into inputs of the next run() natively, e.g. present -> past key/values.
+  // Those outputs are not returned and those inputs no longer have to be passed. The first run
+  // starts from an empty state unless it is fed: dynamic dims named like a dim of a fed input
+  // (e.g. batch_size) take its size, another dynamic first dim is the batch of the feeds and
+  // the remaining dynamic dims (the past sequence length) are 0. Fixed-size states are zeroed.
+  // `initialShapes` sets the shape of that empty state per input instead, e.g. [1, 32, 0, 128].
+  enableState(
+    outputToInput: Record<string, string>,
+    initialShapes?: Record<string, number[]>
+  ): void;
+  disableState(): void;
+  // Converts raw frames fed to `inputName` natively (resize, normalize, layout) straight into the
+  // float32 input tensor. Pass undefined to feed the tensor data directly again.
+  setImagePreprocessing(
+    inputName: string,
+    options?: ImagePreprocessing
+  ): void;
+  // Replaces what run() returns for `outputName` by the postprocessed result, pass undefined to
+  // get the raw output again. runBatch() always returns raw outputs.
+  setPostprocessing(outputName: string, options?: Postprocessing): void;
+  // Drops the carried state, the next run starts a new sequence
+  resetState(): void;
+  // Runs the decoding loop natively and resolves with the generated tokens. With state enabled
+  // only the newest token is fed per step, otherwise the whole sequence. Attention mask and
+  // position ids inputs are filled in when the model has them. A generation starts a new
+  // sequence and holds the state until it ends: run() calls that use the state and changes to
+  // it (enableState, disableState, resetState) throw in the meantime. dispose() stops it.
+  generate(
+    options: GenerateOptions,
+    onToken?: (token: number) => void
+  ): Promise<number[]>;
+  readonly stats: RunStats;
+  getMemoryUsage(): MemoryUsage;
+  resetStats(): void;
+  // Stops profiling started through SessionOptions.enableProfiling and returns the trace file path.
+  // Empty when profiling wasn't enabled or has already ended.
+  endProfiling(): string;
+}
+
+// Replicas of one model with a native thread each, so that concurrent runs don't queue behind each
+// other. A run goes to an idle replica, idle replicas take over runs queued on busy ones. Whether
+// that beats one session with more intraOpNumThreads depends on the model and the device, compare
+// both on the target device. Each replica costs memory of its own on top of the shared weights,
+// see loadSessionPool().
+export interface SessionPool
+  extends HybridObject<{ ios: 'c++'; android: 'c++' }> {
+  readonly size: number; // Number of replicas
+  readonly inputNames: Tensor[];
+  readonly outputNames: Tensor[];
+  // Feeds are always copied, the run may happen on any replica's thread
   run(
-    feeds: Record<string, ArrayBuffer>
-    // options: RunOptions
+    feeds: Record<string, Feed>,
+    options?: RunOptions
   ): Promise<Record<string, ArrayBuffer>>;
+  // Cancels queued and in-flight runs, only the ones with the given tag if one is passed
+  terminate(tag?: string): void;
 }
 
 // Interface for ONNX Runtime in Nitro
@@ -53,6 +306,45 @@ export interface Onnxruntime
     buffer: ArrayBuffer,
     options?: SessionOptions
   ): Promise<InferenceSession>;
+
+  // Loads a model bundled with the app (APK assets on Android, main bundle on iOS) by mapping it.
+  // Android only maps assets stored uncompressed, add `androidResources { noCompress += ["onnx", "ort"] }`
+  // to the app's build.gradle. ORT-format models are then used in place, ONNX-format models are
+  // still parsed into memory once while the session is created.
+  loadModelFromAsset(
+    assetPath: string,
+    options?: SessionOptions
+  ): Promise<InferenceSession>;
+
+  // Loads `replicas` sessions of the model, e.g. one per big core. intraOpNumThreads applies to each
+  // replica and defaults to 1. The replicas share one copy of the weights and of their packed form
+  // (ONNX-format models, initializers of at least 4 KB stored in the model file). ORT-format models
+  // and models loaded through modelCacheDirectory share the mapped weights, but every replica packs
+  // its own copy. Initializers in external data files are loaded by every replica. Whatever isn't
+  // shared (the graph, kernels, arenas and those copies) is paid `replicas` times. For a MatMul-heavy
+  // ORT-format model the packed weights of each replica take about as much memory as the model.
+  loadSessionPool(
+    modelPath: string,
+    replicas: number,
+    options?: SessionOptions
+  ): Promise<SessionPool>;
+
+  // Replaces the worker pool used by sessions loaded afterwards
+  configureWorkerPool(options: WorkerPoolOptions): void;
+
+  // Creates the environment with thread pools shared by sessions using useGlobalThreadPools.
+  // Has to be called before the first model is loaded.
+  configureThreadPools(options: ThreadPoolOptions): void;
+
+  // Caps the memory of loaded sessions in bytes, 0 (the default) disables it. Idle sessions are
+  // evicted least recently used first and reload on their next run. Sessions sharing one loaded
+  // model count once and are evicted together. Sessions with bound outputs, carried state or a
+  // profile that hasn't ended stay loaded.
+  setMemoryBudget(bytes: number): void;
+
+  // Shrinks arenas (of sessions with enableCpuMemArena) and evicts idle sessions down to half the
+  // budget, or all of them when critical. Called automatically on the platform's memory warnings.
+  trimMemory(critical: boolean): void;
 }
 
 export interface AssetManager
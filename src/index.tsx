@@ -10,16 +10,19 @@ const assetManager =
 
 type SessionOptions = Omit<
   InferenceSession.SessionOptions,
-  | 'freeDimensionOverrides'
-  | 'optimizedModelFilePath'
-  | 'enableProfiling'
-  | 'profileFilePrefix'
   | 'logVerbosityLevel'
   | 'preferredOutputLocation'
   | 'enableGraphCapture'
   | 'extra'
   | 'externalData'
->;
+> & {
+  modelCacheDirectory?: string;
+  modelCacheMaxBytes?: number;
+  useGlobalThreadPools?: boolean;
+  weightsVariant?: string;
+  weightsVariantFallback?: boolean;
+  disablePrepacking?: boolean;
+};
 
 type Require = number; // ReturnType<typeof require>
 type ModelSource = Require | { url: string } | string;
@@ -54,8 +57,27 @@ export function copyFile(source: ModelSource): Promise<string> {
   return assetManager.copyFile(uri);
 }
 
+// Local files are loaded in place, which includes require()d models bundled on iOS release builds.
+// The rest is copied to a file first: Metro serves require()d models over http in debug builds,
+// and Android packs them as raw resources, which loadModelFromAsset can't open as assets.
+async function resolveModelPath(source: ModelSource): Promise<string> {
+  if (typeof source === 'string') {
+    return source;
+  }
+  let uri: string | undefined;
+  if (typeof source === 'number') {
+    uri = Image.resolveAssetSource(source)?.uri;
+  } else if (typeof source === 'object' && 'url' in source) {
+    uri = source.url;
+  }
+  if (uri?.startsWith('file://')) {
+    return uri;
+  }
+  return copyFile(source);
+}
+
 async function loadModel(source: ModelSource, options?: SessionOptions) {
-  const path = typeof source === 'string' ? source : await copyFile(source);
+  const path = await resolveModelPath(source);
   //@ts-ignore Allowing the use of the SessionOptions type which is fully compatible with the nitro types
   return ort.loadModel(path, options);
 }
@@ -68,6 +90,26 @@ async function loadModelFromBuffer(
   return ort.loadModelFromBuffer(buffer, options);
 }
 
+async function loadModelFromAsset(
+  assetPath: string,
+  options?: SessionOptions
+) {
+  //@ts-ignore Allowing the use of the SessionOptions type which is fully compatible with the nitro types
+  return ort.loadModelFromAsset(assetPath, options);
+}
+
+// Replicas share one copy of the weights of ONNX-format models, everything else (and the
+// packed weights of ORT-format or cached models) is held once per replica, see Onnxruntime.nitro.ts
+async function loadSessionPool(
+  source: ModelSource,
+  replicas: number,
+  options?: SessionOptions
+) {
+  const path = await resolveModelPath(source);
+  //@ts-ignore Allowing the use of the SessionOptions type which is fully compatible with the nitro types
+  return ort.loadSessionPool(path, replicas, options);
+}
+
 export function useLoadModel(source: ModelSource, options?: SessionOptions) {
   const [state, setState] = useState<OnnxRuntimePlugin>({
     model: undefined,
@@ -97,4 +139,6 @@ export default {
   useLoadModel,
   loadModel,
   loadModelFromBuffer,
+  loadModelFromAsset,
+  loadSessionPool,
 };